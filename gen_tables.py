@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+#
+# Generates qrcodegen_tables.h, the constant per-version tables that qrcodegen.c
+# uses instead of computing them at runtime when built with QRCODEGEN_GENERATED_TABLES.
+# micropython.mk and micropython.cmake run this as part of the build.
+#
+# Usage: gen_tables.py [max_version] [output_file]
+#
+# The geometry tables always cover all 40 versions. The placement maps, which are much
+# larger, cover versions 1 to max_version (default 10), which must be at least the
+# QRCODEGEN_CACHE_VERSION_MAX of the build.
+#
+import sys
+
+# Copied from qrcodegen.c, indexed by [ecl][version]
+ECC_CODEWORDS_PER_BLOCK = [
+    [-1,  7, 10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26, 30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30],
+    [-1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22, 24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28],
+    [-1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24, 20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30],
+    [-1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22, 24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30],
+]
+NUM_ERROR_CORRECTION_BLOCKS = [
+    [-1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 4,  4,  4,  4,  4,  6,  6,  6,  6,  7,  8,  8,  9,  9, 10, 12, 12, 12, 13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25],
+    [-1, 1, 1, 1, 2, 2, 4, 4, 4, 5, 5,  5,  8,  9,  9, 10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25, 26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49],
+    [-1, 1, 1, 2, 2, 4, 4, 6, 6, 8, 8,  8, 10, 12, 16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34, 35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68],
+    [-1, 1, 1, 2, 4, 4, 4, 5, 6, 8, 8, 11, 11, 16, 16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81],
+]
+
+
+def num_raw_data_modules(ver):
+    # Same as getNumRawDataModules() in qrcodegen.c
+    result = (16 * ver + 128) * ver + 64
+    if ver >= 2:
+        num_align = ver // 7 + 2
+        result -= (25 * num_align - 10) * num_align - 55
+        if ver >= 7:
+            result -= 36
+    return result
+
+
+def num_data_codewords(ver, ecl):
+    # Same as getNumDataCodewords() in qrcodegen.c
+    return num_raw_data_modules(ver) // 8 - ECC_CODEWORDS_PER_BLOCK[ecl][ver] * NUM_ERROR_CORRECTION_BLOCKS[ecl][ver]
+
+
+def format_bits(ecl, mask):
+    # Same as drawFormatBits() in qrcodegen.c
+    data = [1, 0, 3, 2][ecl] << 3 | mask
+    rem = data
+    for _ in range(10):
+        rem = (rem << 1) ^ ((rem >> 9) * 0x537)
+    return (data << 10 | rem) ^ 0x5412
+
+
+def version_bits(ver):
+    # Same as drawLightFunctionModules() in qrcodegen.c; 0 for versions without version information
+    if ver < 7:
+        return 0
+    rem = ver
+    for _ in range(12):
+        rem = (rem << 1) ^ ((rem >> 11) * 0x1F25)
+    return ver << 12 | rem
+
+
+def alignment_positions(ver):
+    # Same as getAlignmentPatternPositions() in qrcodegen.c
+    if ver == 1:
+        return []
+    num_align = ver // 7 + 2
+    step = 26 if ver == 32 else (ver * 4 + num_align * 2 + 1) // (num_align * 2 - 2) * 2
+    result = [0] * num_align
+    pos = ver * 4 + 10
+    for i in range(num_align - 1, 0, -1):
+        result[i] = pos
+        pos -= step
+    result[0] = 6
+    return result
+
+
+def function_modules(ver):
+    # Same modules as initializeFunctionModules() in qrcodegen.c, as a list of rows
+    size = ver * 4 + 17
+    grid = [[False] * size for _ in range(size)]
+
+    def fill(left, top, width, height):
+        for y in range(top, top + height):
+            for x in range(left, left + width):
+                grid[y][x] = True
+
+    # Timing patterns, finder patterns with separators and format bits
+    fill(6, 0, 1, size)
+    fill(0, 6, size, 1)
+    fill(0, 0, 9, 9)
+    fill(size - 8, 0, 8, 9)
+    fill(0, size - 8, 9, 8)
+
+    # Alignment patterns, except the three that overlap finders
+    align = alignment_positions(ver)
+    n = len(align)
+    for i in range(n):
+        for j in range(n):
+            if (i, j) not in ((0, 0), (0, n - 1), (n - 1, 0)):
+                fill(align[i] - 2, align[j] - 2, 5, 5)
+
+    # Version information
+    if ver >= 7:
+        fill(size - 11, 0, 3, 6)
+        fill(0, size - 11, 6, 3)
+    return grid
+
+
+def placement_map(ver):
+    # Same as buildPlacementMap() in qrcodegen.c
+    grid = function_modules(ver)
+    size = len(grid)
+    runs = []
+    n = 0
+    right = size - 1
+    while right >= 1:
+        if right == 6:
+            right = 5
+        in_run = False
+        for vert in range(size):
+            for j in range(2):
+                upward = ((right + 1) & 2) == 0
+                y = size - 1 - vert if upward else vert
+                if grid[y][right - j]:
+                    in_run = False
+                elif in_run:
+                    runs[-1][1] += 1
+                else:
+                    runs.append([n, 1])
+                    in_run = True
+                n += 1
+        right -= 2
+    assert len(runs) <= 12 * ver + 12
+    return [len(runs)] + [v for run in runs for v in run]
+
+
+def c_array(decl, values, per_line=12):
+    lines = [decl + ' = {']
+    for i in range(0, len(values), per_line):
+        lines.append('\t' + ', '.join(str(v) for v in values[i : i + per_line]) + ',')
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def c_array_2d(decl, rows):
+    return '\n'.join([decl + ' = {'] + ['\t{' + ', '.join(str(v) for v in row) + '},' for row in rows] + ['};'])
+
+
+def generate(max_version):
+    versions = range(41)  # Index 0 is padding, as in the tables of qrcodegen.c
+    maps = []
+    offsets = []
+    for ver in range(1, max_version + 1):
+        offsets.append(len(maps))
+        maps.extend(placement_map(ver))
+    assert len(maps) < 65536
+
+    out = [
+        '// Generated by gen_tables.py; do not edit. Placement maps cover versions 1 to %d' % max_version,
+        '// and use %d bytes of flash.' % (len(maps) * 2),
+        '',
+        '#define QRCODEGEN_TABLES_VERSION_MAX  %d' % max_version,
+        '',
+        '// getNumRawDataModules() by version',
+        c_array('static const uint16_t NUM_RAW_DATA_MODULES[41]',
+            [0] + [num_raw_data_modules(v) for v in versions[1:]]),
+        '',
+        '// getNumDataCodewords() by ECC level and version',
+        c_array_2d('static const uint16_t NUM_DATA_CODEWORDS[4][41]',
+            [[0] + [num_data_codewords(v, e) for v in versions[1:]] for e in range(4)]),
+        '',
+        '// getAlignmentPatternPositions() by version, padded with zeros',
+        c_array_2d('static const uint8_t ALIGNMENT_PATTERN_POSITIONS[41][7]',
+            [(alignment_positions(v) + [0] * 7)[:7] if v else [0] * 7 for v in versions]),
+        '',
+        '// The 15 format bits of drawFormatBits() by ECC level and mask',
+        c_array_2d('static const uint16_t FORMAT_BITS[4][8]',
+            [['0x%04X' % format_bits(e, m) for m in range(8)] for e in range(4)]),
+        '',
+        '// The 18 version bits of drawLightFunctionModules() by version, 0 below version 7',
+        c_array('static const uint32_t VERSION_BITS[41]', ['0x%05X' % version_bits(v) for v in versions], 8),
+        '',
+        '// The placement maps of buildPlacementMap(), one after another in ascending order of version',
+        c_array('static const uint16_t PLACEMENT_MAPS[%d]' % len(maps), maps),
+        '',
+        c_array('static const uint16_t PLACEMENT_MAP_OFFSETS[%d]' % max_version, offsets),
+        '',
+    ]
+    return '\n'.join(out)
+
+
+if __name__ == '__main__':
+    max_version = int(sys.argv[1]) if len(sys.argv) > 1 else 10
+    if not 1 <= max_version <= 40:
+        sys.exit('max_version must be in the range [1, 40]')
+    text = generate(max_version)
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], 'w') as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
@@ -1,11 +1,49 @@
 add_library(usermod_uqr INTERFACE)
 
+# Highest version whose placement map is generated into flash; must be at least
+# QRCODEGEN_CACHE_VERSION_MAX. Geometry tables always cover all 40 versions.
+set(UQR_TABLES_VERSION_MAX 10 CACHE STRING "Highest QR version with a generated placement map")
+
+find_package(Python3 REQUIRED COMPONENTS Interpreter)
+
+# The version is part of the path, so changing UQR_TABLES_VERSION_MAX uses (or
+# generates) a header made for that version, and the changed include directory
+# rebuilds what uses it. A header left from another version is never picked up.
+set(UQR_TABLES_DIR ${CMAKE_CURRENT_BINARY_DIR}/uqr/v${UQR_TABLES_VERSION_MAX})
+set(UQR_TABLES_HEADER ${UQR_TABLES_DIR}/qrcodegen_tables.h)
+
+# Generate once per version at configure time so the qstr preprocessing pass can
+# see the header, then keep it up to date with the generator.
+file(MAKE_DIRECTORY ${UQR_TABLES_DIR})
+if(NOT EXISTS ${UQR_TABLES_HEADER})
+    execute_process(
+        COMMAND ${Python3_EXECUTABLE} ${CMAKE_CURRENT_LIST_DIR}/gen_tables.py
+            ${UQR_TABLES_VERSION_MAX} ${UQR_TABLES_HEADER}
+        RESULT_VARIABLE UQR_TABLES_RESULT
+    )
+    if(NOT UQR_TABLES_RESULT EQUAL 0)
+        message(FATAL_ERROR "gen_tables.py failed")
+    endif()
+endif()
+add_custom_command(
+    OUTPUT ${UQR_TABLES_HEADER}
+    COMMAND ${Python3_EXECUTABLE} ${CMAKE_CURRENT_LIST_DIR}/gen_tables.py
+        ${UQR_TABLES_VERSION_MAX} ${UQR_TABLES_HEADER}
+    DEPENDS ${CMAKE_CURRENT_LIST_DIR}/gen_tables.py
+)
+
 target_sources(usermod_uqr INTERFACE
     ${CMAKE_CURRENT_LIST_DIR}/moduqr.c
+    ${UQR_TABLES_HEADER}
 )
 
 target_include_directories(usermod_uqr INTERFACE
     ${CMAKE_CURRENT_LIST_DIR}
+    ${UQR_TABLES_DIR}
+)
+
+target_compile_definitions(usermod_uqr INTERFACE
+    QRCODEGEN_GENERATED_TABLES
 )
 
 target_link_libraries(usermod INTERFACE usermod_uqr)
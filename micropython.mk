@@ -2,7 +2,29 @@
 
 UQR_MOD_DIR := $(USERMOD_DIR)
 
+# Highest version whose placement map is generated into flash; must be at least
+# QRCODEGEN_CACHE_VERSION_MAX. Geometry tables always cover all 40 versions.
+UQR_TABLES_VERSION_MAX ?= 10
+
 SRC_USERMOD += $(UQR_MOD_DIR)/moduqr.c
 
+CFLAGS_USERMOD += -I$(BUILD)/uqr -DQRCODEGEN_GENERATED_TABLES
+
+# Holds UQR_TABLES_VERSION_MAX, and is rewritten only when that changes, so that
+# changing it regenerates the tables and rebuilds what includes them.
+$(BUILD)/uqr/tables_version: uqr_tables_version_check
+	$(Q)$(MKDIR) -p $(dir $@)
+	$(Q)echo $(UQR_TABLES_VERSION_MAX) | cmp -s - $@ || echo $(UQR_TABLES_VERSION_MAX) > $@
+
+.PHONY: uqr_tables_version_check
+uqr_tables_version_check:
+
+$(BUILD)/uqr/qrcodegen_tables.h: $(UQR_MOD_DIR)/gen_tables.py $(BUILD)/uqr/tables_version
+	$(ECHO) "GEN $@"
+	$(Q)$(MKDIR) -p $(dir $@)
+	$(Q)$(PYTHON) $< $(UQR_TABLES_VERSION_MAX) $@
+
+QSTR_GLOBAL_REQUIREMENTS += $(BUILD)/uqr/qrcodegen_tables.h
+
 xdebug:
 	echo $(SRC_USERMOD)
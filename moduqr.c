@@ -14,44 +14,141 @@
 # define MP_ERROR_TEXT(x)           (x)
 #endif
 
+// Value for the encoding argument that splits the message into numeric, alphanumeric
+// and byte segments for the fewest bits. (QR mode indicators are all positive.)
+#define UQR_MODE_OPTIMAL    (-1)
+
+// Segments kept on the stack by the optimal encoding; more are allocated on the heap.
+#define UQR_STACK_SEGMENTS  16
+
+// Work buffers up to this size go on the C stack, larger ones on the heap. With these
+// defaults make()'s own frame holds 408 bytes of buffer and 16 segments for any max_version.
+// Its deepest call is mask scoring: uqr_encode -> qrcodegen_encodeSegmentsText ->
+// getPenaltyScore -> getRowPenaltyScore -> getLinePenaltyScore. Measured with gcc -O2
+// -fstack-usage on x86-64, that path peaks at 2256 bytes of C stack, make() included.
+#ifndef UQR_STACK_BUFFER_LEN
+# define UQR_STACK_BUFFER_LEN   qrcodegen_BUFFER_LEN_FOR_VERSION(10)
+#endif
+
 // Our object. Holds a rendered QR
 typedef struct _mp_obj_rendered_qr_t {
     mp_obj_base_t base;
 
-    // the library creates this binary blob that it knows how to turn
-    // into images; seems to encode version # in first byte, but IDK.
+    // in modules, from 21 to 177
+    int     width;
+
+    // the QR's rows as packed() returns them: see UQR_PACKED_LEN_FOR_VERSION. A GC block
+    // of its own, so the buffer protocol hands out the start of it, which is what the GC
+    // needs to see for a memoryview to keep it alive.
     byte    *rendered;
+
+    // bytes allocated for rendered; more than this QR needs after Encoder.encode(out=...)
+    // has reused the object for a smaller one
+    size_t  rendered_len;
+
+    // rendered has been handed out through the buffer protocol, so a memoryview may
+    // still point at it: leave freeing it to the GC
+    bool    exported;
+
+    // counts encodes into this object, so rows() can tell it was re-encoded under it
+    unsigned int generation;
 } mp_obj_rendered_qr_t;
 
-// rendered_qr_make_new()
+STATIC const mp_obj_type_t mp_type_rendered_qr;
+
+// A RenderedQR keeps its QR in the layout that packed() returns, so that can be handed
+// out without repacking: each row with 8 modules per byte, MSB first, padded to a whole
+// byte. Never smaller than the library's buffer for the same version.
+#define UQR_STRIDE(width)               (((width) + 7) / 8)
+#define UQR_PACKED_LEN_FOR_VERSION(v)   (UQR_STRIDE((v) * 4 + 17) * ((v) * 4 + 17))
+
+// uqr_get_module()
 //
-// Constructor: RenderedQR object
+// Read a module from a RenderedQR; false if outside it, like qrcodegen_getModule().
 //
-    STATIC mp_obj_t
-rendered_qr_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
+    static inline bool
+uqr_get_module(const mp_obj_rendered_qr_t *qr, int x, int y)
 {
-    mp_arg_check_num(n_args, n_kw, 1, 1, true);
-    mp_map_t kw_args;
-    mp_map_init_fixed_table(&kw_args, n_kw, all_args + n_args);
+    int w = qr->width;
 
-    enum {ARG_message, ARG_encoding, ARG_max_version, ARG_min_version, ARG_mask, ARG_ecl};
-    const mp_arg_t allowed_args[] = {
-        { MP_QSTR_message, MP_ARG_OBJ|MP_ARG_REQUIRED, {}},
-        { MP_QSTR_encoding, MP_ARG_INT, { .u_int = 0 } },
-        { MP_QSTR_max_version, MP_ARG_INT, { .u_int = 10 } },
-        { MP_QSTR_min_version, MP_ARG_INT, { .u_int = 1 } },
-        { MP_QSTR_mask, MP_ARG_INT, { .u_int = qrcodegen_Mask_AUTO } },
-        { MP_QSTR_ecl, MP_ARG_INT, { .u_int = qrcodegen_Ecc_LOW } },
-    };
+    if(x < 0 || x >= w || y < 0 || y >= w) {
+        return false;
+    }
 
-    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
-    mp_arg_parse_all(n_args, all_args, &kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+    return (qr->rendered[y * UQR_STRIDE(w) + (x >> 3)] >> (7 - (x & 7))) & 1;
+}
 
-    // first arg: text to encode
-    mp_buffer_info_t bufinfo;
-    mp_get_buffer_raise(args[0].u_obj, &bufinfo, MP_BUFFER_READ);
+// uqr_pack_rows()
+//
+// Convert the library's QR (LSB first, rows back to back) to the packed rows at dest.
+// Gathers 8 modules at a time and reverses their bit order.
+//
+    STATIC void
+uqr_pack_rows(const uint8_t *qr, uint8_t *dest)
+{
+    int w = qrcodegen_getSize(qr);
+    const uint8_t *bits = qr + 1;
+
+    for(int y=0; y < w; y++) {
+        for(int x=0; x < w; x += 8) {
+            int count = (w - x < 8) ? (w - x) : 8;
+            size_t i = (size_t)y * w + x;
+            int shift = i & 7;
+
+            unsigned v = bits[i >> 3] >> shift;
+            if(count > 8 - shift) {
+                v |= bits[(i >> 3) + 1] << (8 - shift);
+            }
+            v &= (1u << count) - 1;     // padding bits stay clear
+
+            // first module into the MSB
+            v = ((v & 0xf0) >> 4) | ((v & 0x0f) << 4);
+            v = ((v & 0xcc) >> 2) | ((v & 0x33) << 2);
+            v = ((v & 0xaa) >> 1) | ((v & 0x55) << 1);
+
+            *(dest++) = v;
+        }
+    }
+}
 
-    int max_version = args[ARG_max_version].u_int;      // 10 => 408 bytes (*2 required) on stack
+// Options shared by make() and Encoder(), after range checks.
+typedef struct _uqr_options_t {
+    int     min_version;
+    int     max_version;
+    int     encoding;
+    enum qrcodegen_Mask mask;
+    enum qrcodegen_Ecc ecl;
+} uqr_options_t;
+
+// Work space for one encode. make() lends stack buffers for a single call and anything
+// bigger comes from the heap and goes back; an Encoder owns its buffers and grows them
+// as needed, so repeated encodes stop allocating.
+typedef struct _uqr_work_t {
+    uint8_t *buf;
+    size_t  buf_len;
+    struct qrcodegen_Segment *segs;
+    size_t  max_segs;
+    bool    owned;
+} uqr_work_t;
+
+// The option arguments, in the order of uqr_options_t; make() takes the message first.
+#define UQR_OPTION_ARGS \
+        { MP_QSTR_encoding, MP_ARG_INT, { .u_int = 0 } }, \
+        { MP_QSTR_max_version, MP_ARG_INT, { .u_int = qrcodegen_VERSION_MAX } }, \
+        { MP_QSTR_min_version, MP_ARG_INT, { .u_int = 1 } }, \
+        { MP_QSTR_mask, MP_ARG_INT, { .u_int = qrcodegen_Mask_AUTO } }, \
+        { MP_QSTR_ecl, MP_ARG_INT, { .u_int = qrcodegen_Ecc_LOW } }
+
+enum {ARG_encoding, ARG_max_version, ARG_min_version, ARG_mask, ARG_ecl, UQR_NUM_OPTION_ARGS};
+
+// uqr_get_options()
+//
+// Range check the parsed UQR_OPTION_ARGS. The encoding is checked against the message later.
+//
+    STATIC void
+uqr_get_options(const mp_arg_val_t *args, uqr_options_t *opts)
+{
+    int max_version = args[ARG_max_version].u_int;      // buffers are sized for the version used
     int min_version = args[ARG_min_version].u_int;      // 1 => typpical use cases
 
     // range checks
@@ -76,89 +173,311 @@ rendered_qr_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, cons
     }
     switch(args[ARG_mask].u_int) {
 	    case qrcodegen_Mask_AUTO:
+	    case qrcodegen_Mask_FAST:
 	    case qrcodegen_Mask_0 ...  qrcodegen_Mask_7:
             break;
         default:
             mp_raise_ValueError(MP_ERROR_TEXT("mask"));
     }
 
-    enum qrcodegen_Ecc ecl = args[ARG_ecl].u_int;
-    enum qrcodegen_Mask mask = args[ARG_mask].u_int;
-    enum qrcodegen_Mode encoding = args[ARG_encoding].u_int;        // range check below
+    opts->min_version = min_version;
+    opts->max_version = max_version;
+    opts->encoding = args[ARG_encoding].u_int;
+    opts->mask = args[ARG_mask].u_int;
+    opts->ecl = args[ARG_ecl].u_int;
+}
+
+// uqr_work_buffer()
+//
+// Returns len bytes of work space: the work buffer if it is big enough, else the heap.
+// Owned buffers are grown to fit instead, and kept.
+//
+    STATIC uint8_t *
+uqr_work_buffer(uqr_work_t *work, size_t len)
+{
+    if(len <= work->buf_len) {
+        return work->buf;
+    }
+    if(!work->owned) {
+        return m_new(uint8_t, len);
+    }
+
+    work->buf = m_renew(uint8_t, work->buf, work->buf_len, len);
+    work->buf_len = len;
+
+    return work->buf;
+}
+
+// uqr_free_work_buffer()
+//
+// Releases what uqr_work_buffer() returned.
+//
+    STATIC void
+uqr_free_work_buffer(uqr_work_t *work, uint8_t *buf, size_t len)
+{
+    if(buf != work->buf) {
+        m_del(uint8_t, buf, len);
+    }
+}
+
+// uqr_work_segs()
+//
+// Same as uqr_work_buffer(), for an array of count segments.
+//
+    STATIC struct qrcodegen_Segment *
+uqr_work_segs(uqr_work_t *work, size_t count)
+{
+    if(count <= work->max_segs) {
+        return work->segs;
+    }
+    if(!work->owned) {
+        return m_new(struct qrcodegen_Segment, count);
+    }
+
+    work->segs = m_renew(struct qrcodegen_Segment, work->segs, work->max_segs, count);
+    work->max_segs = count;
+
+    return work->segs;
+}
+
+// uqr_free_work_segs()
+//
+// Releases what uqr_work_segs() returned.
+//
+    STATIC void
+uqr_free_work_segs(uqr_work_t *work, struct qrcodegen_Segment *segs, size_t count)
+{
+    if(segs != work->segs) {
+        m_del(struct qrcodegen_Segment, segs, count);
+    }
+}
+
+// rendered_qr_release()
+//
+// Free the QR data, if any.
+//
+    STATIC void
+rendered_qr_release(mp_obj_rendered_qr_t *self)
+{
+    if(self->rendered) {
+        if(!self->exported) {
+            m_del(byte, self->rendered, self->rendered_len);
+        }
+        self->rendered = NULL;
+        self->rendered_len = 0;
+        self->exported = false;
+    }
+}
+
+// rendered_qr_reserve()
+//
+// Make room for a QR of len bytes. A buffer that is already big enough is kept as-is,
+// unless something may still read it: a view from the buffer protocol, or (in_use)
+// the message being encoded. Then the QR goes in a new buffer and the GC frees the old.
+//
+    STATIC void
+rendered_qr_reserve(mp_obj_rendered_qr_t *self, size_t len, bool in_use)
+{
+    if(self->rendered && self->rendered_len >= len && !self->exported && !in_use) {
+        return;
+    }
+
+    // contents aren't kept, so no need to realloc. On the GC heap (not malloc) so
+    // that memoryviews from the buffer protocol, which point at its start, keep it alive.
+    // Allocated before the old one goes, so a MemoryError leaves self with its QR.
+    byte *buf = m_new(byte, len);
+
+    if(in_use) {
+        self->exported = true;      // so not freed yet
+    }
+    rendered_qr_release(self);
+
+    self->rendered = buf;
+    self->rendered_len = len;
+}
+
+// uqr_encode()
+//
+// Encode message into out, or into a new RenderedQR when out is NULL, and return it.
+//
+    STATIC mp_obj_rendered_qr_t *
+uqr_encode(const uqr_options_t *opts, uqr_work_t *work, mp_obj_t message, mp_obj_rendered_qr_t *out)
+{
+    // text to encode. Another RenderedQR is read directly rather than through the buffer
+    // protocol, which would mark it exported though no view of it outlives this call.
+    mp_buffer_info_t bufinfo;
+    if(mp_obj_is_type(message, &mp_type_rendered_qr)) {
+        mp_obj_rendered_qr_t *src = MP_OBJ_TO_PTR(message);
+        bufinfo.buf = src->rendered;
+        bufinfo.len = UQR_STRIDE(src->width) * src->width;
+    } else {
+        mp_get_buffer_raise(message, &bufinfo, MP_BUFFER_READ);
+    }
+
+    enum qrcodegen_Ecc ecl = opts->ecl;
+    int encoding = opts->encoding;              // range check below
     const bool boost_ecl = true;            // because why not
-    
-    // prepare an output buffer (the QR result)
-    uint8_t     tmp[qrcodegen_BUFFER_LEN_FOR_VERSION(max_version)];
-    uint8_t     result[qrcodegen_BUFFER_LEN_FOR_VERSION(max_version)];
-
-    bool ok = false;
-
-    if(encoding == 0) {
-        const char *as_str = mp_obj_str_get_str(args[0].u_obj);
-
-        // Auto mode: pick best mode (sic) ... slower, simplistic; assumes string input
-        ok =  qrcodegen_encodeText(as_str, tmp, result, 
-                            ecl, min_version, max_version, mask, boost_ecl);
-    } else if(encoding == qrcodegen_Mode_BYTE) {
-        // Pure binary mode.
-        struct qrcodegen_Segment seg;
-
-        // work in-place, makes no assumptions about NUL bytes
-        seg.mode = qrcodegen_Mode_BYTE;
-        seg.numChars = bufinfo.len;
-        seg.bitLength = calcSegmentBitLength(seg.mode, bufinfo.len);
-        seg.data = bufinfo.buf;
-
-        ok =  qrcodegen_encodeSegmentsAdvanced(&seg, 1, 
-                            ecl, min_version, max_version, mask, boost_ecl,
-                            tmp, result);
+
+    // Choose the version first, from segments that only describe the message: the
+    // encoder packs the characters straight from the message into the QR data.
+    struct qrcodegen_Segment *seg = work->segs;
+    size_t num_segs = 0;
+    int version = 0;
+
+    if(encoding == UQR_MODE_OPTIMAL) {
+        // Mixed segments, chosen for the character count field widths of each
+        // version range in turn (they widen after versions 9 and 26). The first
+        // range that fits wins, since every later range has larger versions.
+        static const int range_end[] = { 9, 26, qrcodegen_VERSION_MAX };
+
+        // segmenting needs a byte of work space per character
+        uint8_t *buf = uqr_work_buffer(work, bufinfo.len);
+
+        int lo = opts->min_version;
+        for(size_t i = 0; i < MP_ARRAY_SIZE(range_end) && !version; i++) {
+            if(range_end[i] < lo) continue;
+            int hi = (range_end[i] < opts->max_version) ? range_end[i] : opts->max_version;
+
+            uqr_free_work_segs(work, seg, num_segs);
+            seg = work->segs;
+
+            num_segs = qrcodegen_makeSegmentsOptimally(bufinfo.buf, bufinfo.len, lo,
+                                    buf, seg, work->max_segs);
+            if(num_segs == SIZE_MAX) {
+                break;      // some part is too long for any QR
+            }
+            if(num_segs > work->max_segs) {
+                seg = uqr_work_segs(work, num_segs);
+                qrcodegen_makeSegmentsOptimally(bufinfo.buf, bufinfo.len, lo,
+                                    buf, seg, num_segs);
+            }
+
+            version = qrcodegen_getMinVersion(seg, num_segs, ecl, lo, hi);
+            if(hi == opts->max_version) break;
+            lo = hi + 1;
+        }
+
+        uqr_free_work_buffer(work, buf, bufinfo.len);
     } else {
-        // library assumes incoming is text, NUL-terminated strings.
-        const char *as_str = mp_obj_str_get_str(args[0].u_obj);
-        uint8_t     encoded[strlen(as_str)+10];
-        struct qrcodegen_Segment seg;
+        // One segment in a single mode, so bytes, bytearray and memoryview
+        // slices work as well as strings.
+        size_t valid_len[2] = { 0, 0 };
+        enum qrcodegen_Mode best = qrcodegen_Mode_BYTE;
+
+        if(encoding != qrcodegen_Mode_BYTE) {
+            best = qrcodegen_classifyText(bufinfo.buf, bufinfo.len, &valid_len[0], &valid_len[1]);
+        }
 
-        // make one segment after packing it for the indicated encoding
         switch(encoding) {
+            case 0:
+                // auto: the most compact mode that holds the whole message
+                encoding = best;
+                break;
+
             case qrcodegen_Mode_NUMERIC:
-                seg = qrcodegen_makeNumeric(as_str, encoded);
+            case qrcodegen_Mode_ALPHANUMERIC: {
+                size_t bad = valid_len[encoding == qrcodegen_Mode_ALPHANUMERIC];
+                if(bad < bufinfo.len) {
+                    mp_raise_msg_varg(&mp_type_ValueError,
+                        MP_ERROR_TEXT("can't encode character at offset %d"), (int)bad);
+                }
                 break;
+            }
 
-            case qrcodegen_Mode_ALPHANUMERIC:
-                seg = qrcodegen_makeAlphanumeric(as_str, encoded);
+            case qrcodegen_Mode_BYTE:
                 break;
-            
+
             default:
                 mp_raise_ValueError(MP_ERROR_TEXT("encoding"));
         }
 
-        ok =  qrcodegen_encodeSegmentsAdvanced(&seg, 1, 
-                            ecl, min_version, max_version, mask, boost_ecl,
-                            tmp, result);
+        seg[0].mode = encoding;
+        seg[0].numChars = bufinfo.len;
+        seg[0].bitLength = calcSegmentBitLength(encoding, bufinfo.len);
+        seg[0].data = NULL;
+        num_segs = (bufinfo.len > 0) ? 1 : 0;
+
+        if(seg[0].bitLength >= 0) {       // else too long for any QR
+            version = qrcodegen_getMinVersion(seg, num_segs, ecl,
+                                    opts->min_version, opts->max_version);
+        }
+    }
+
+    if(!version) {
+        uqr_free_work_segs(work, seg, num_segs);
+        mp_raise_ValueError(MP_ERROR_TEXT("QR data overflow"));
+    }
+
+    // make the object we are returning, unless recycling one.
+    if(!out) {
+        out = m_new_obj_with_finaliser(mp_obj_rendered_qr_t);
+        out->base.type = &mp_type_rendered_qr;
+        out->width = 0;
+        out->rendered = NULL;
+        out->rendered_len = 0;
+        out->exported = false;
+        out->generation = 0;
+    }
+
+    // The QR is drawn straight into the object's own buffer, sized for this version,
+    // and then repacked there from a copy in the (no longer needed) temp buffer. Both
+    // are had before anything is drawn, so running out of memory leaves out as it was.
+    // The message may be out itself, or a view of it, and is read while drawing.
+    size_t qr_len = qrcodegen_BUFFER_LEN_FOR_VERSION(version);
+    const byte *text = bufinfo.buf;
+    bool in_use = out->rendered && text < out->rendered + out->rendered_len
+                        && out->rendered < text + bufinfo.len;
+    uint8_t *tmp = uqr_work_buffer(work, qr_len);
+    rendered_qr_reserve(out, UQR_PACKED_LEN_FOR_VERSION(version), in_use);
+
+    bool ok = qrcodegen_encodeSegmentsText(seg, num_segs, bufinfo.buf,
+                            ecl, version, version, opts->mask, boost_ecl,
+                            tmp, out->rendered, NULL, 0);
+    if(ok) {
+        memcpy(tmp, out->rendered, qr_len);
+        uqr_pack_rows(tmp, out->rendered);
+        out->width = qrcodegen_getSize(tmp);
+        out->generation++;
     }
+    uqr_free_work_buffer(work, tmp, qr_len);
+    uqr_free_work_segs(work, seg, num_segs);
 
     if(!ok) {
         mp_raise_ValueError(MP_ERROR_TEXT("QR data overflow"));
     }
 
-    // make the object we are returning.
-    mp_obj_rendered_qr_t *o = m_new_obj_with_finaliser(mp_obj_rendered_qr_t);
-    o->base.type = type;
-    o->rendered = NULL;
-
-    // Make a copy of the QR data at this point, so it's no bigger than needed.
-    // - would be nice if we could tell how big this needs to be based on *actual* version used
-    // - but I've RE'ed the code, and it's storing image width in first byte, etc.
-    int qrsize = result[0];
-    int out_len = (((qrsize * qrsize) + 7) / 8) + 1;
-#if MICROPY_MALLOC_USES_ALLOCATED_SIZE
-    o->rendered = (uint8_t *)malloc(out_len);
-#else
-    o->rendered = (uint8_t *)m_malloc(out_len);
-#endif
-    memcpy(o->rendered, result, out_len);
+    return out;
+}
 
-    return MP_OBJ_FROM_PTR(o);
+// rendered_qr_make_new()
+//
+// Constructor: RenderedQR object
+//
+    STATIC mp_obj_t
+rendered_qr_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
+{
+    mp_arg_check_num(n_args, n_kw, 1, 1, true);
+    mp_map_t kw_args;
+    mp_map_init_fixed_table(&kw_args, n_kw, all_args + n_args);
+
+    const mp_arg_t allowed_args[] = {
+        { MP_QSTR_message, MP_ARG_OBJ|MP_ARG_REQUIRED, {}},
+        UQR_OPTION_ARGS
+    };
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, all_args, &kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    uqr_options_t opts;
+    uqr_get_options(&args[1], &opts);
+
+    // work space for small QR's; larger ones use the heap
+    uint8_t     stack_buf[UQR_STACK_BUFFER_LEN];
+    struct qrcodegen_Segment stack_segs[UQR_STACK_SEGMENTS];
+    uqr_work_t  work = { stack_buf, sizeof(stack_buf), stack_segs, MP_ARRAY_SIZE(stack_segs), false };
+
+    // first arg: text to encode
+    return MP_OBJ_FROM_PTR(uqr_encode(&opts, &work, args[0].u_obj, NULL));
 }
 
 // rendered_qr_width()
@@ -171,7 +490,7 @@ rendered_qr_width(mp_obj_t self_in)
 {
     mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
 
-    return MP_OBJ_NEW_SMALL_INT(qrcodegen_getSize(self->rendered));
+    return MP_OBJ_NEW_SMALL_INT(self->width);
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(rendered_qr_width_obj, rendered_qr_width);
 
@@ -185,7 +504,7 @@ rendered_qr_version(mp_obj_t self_in)
 {
     mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
 
-    int qrsize = qrcodegen_getSize(self->rendered);     // copies first byte
+    int qrsize = self->width;
 
 	// inverse of: qrsize = version * 4 + 17;
     int version = (qrsize - 17) / 4;
@@ -209,138 +528,1219 @@ rendered_qr_packed(mp_obj_t self_in)
 {
     mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
 
-    int w = qrcodegen_getSize(self->rendered);
+    int w = self->width;
     int sz = (w + 7) & ~0x7;
     int pad = sz - w;      // can be zero (but unlikely, since QR's are odd sizes)
 
     assert(sz % 8 == 0);
     assert(pad < 8);
 
-    uint8_t pix[(sz/8) * w], *p=pix;
-
-    for(int y=0; y < w; y++) {
-        uint8_t bm = 0;
-        for(int x=0; x < w; x++) {
-            bool h = qrcodegen_getModule(self->rendered, x, y);
-            bm = (bm << 1) | h;
-
-            if(x == w-1) {
-                bm <<= pad;
-            }
-            if((x % 8 == 7) || (x == w-1)) {
-                *(p++) = bm;
-                bm = 0;
-            }
-        }
-    }
-    assert((size_t)(p - pix) == sizeof(pix));
-
     mp_obj_tuple_t *rv = MP_OBJ_TO_PTR(mp_obj_new_tuple(3, NULL));
 
     rv->items[0] = MP_OBJ_NEW_SMALL_INT(sz);
     rv->items[1] = MP_OBJ_NEW_SMALL_INT(w);
-    rv->items[2] = mp_obj_new_bytes(pix, sizeof(pix));
+    rv->items[2] = mp_obj_new_bytes(self->rendered, (sz/8) * w);
 
     return MP_OBJ_FROM_PTR(rv);
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(rendered_qr_packed_obj, rendered_qr_packed);
 
-// rendered_qr_get()
+// (W, H) as returned by packed_into(), for each version: constant tuples, so
+// nothing is allocated.
+typedef struct _uqr_size_tuple_t {
+    mp_obj_base_t base;
+    size_t len;
+    mp_rom_obj_t items[2];
+} uqr_size_tuple_t;
+
+#define UQR_SIZE_TUPLE(v)    \
+    { { &mp_type_tuple }, 2, { MP_ROM_INT(UQR_STRIDE((v) * 4 + 17) * 8), MP_ROM_INT((v) * 4 + 17) } }
+
+STATIC const uqr_size_tuple_t uqr_size_tuples[qrcodegen_VERSION_MAX] = {
+    UQR_SIZE_TUPLE(1),  UQR_SIZE_TUPLE(2),  UQR_SIZE_TUPLE(3),  UQR_SIZE_TUPLE(4),  UQR_SIZE_TUPLE(5),
+    UQR_SIZE_TUPLE(6),  UQR_SIZE_TUPLE(7),  UQR_SIZE_TUPLE(8),  UQR_SIZE_TUPLE(9),  UQR_SIZE_TUPLE(10),
+    UQR_SIZE_TUPLE(11), UQR_SIZE_TUPLE(12), UQR_SIZE_TUPLE(13), UQR_SIZE_TUPLE(14), UQR_SIZE_TUPLE(15),
+    UQR_SIZE_TUPLE(16), UQR_SIZE_TUPLE(17), UQR_SIZE_TUPLE(18), UQR_SIZE_TUPLE(19), UQR_SIZE_TUPLE(20),
+    UQR_SIZE_TUPLE(21), UQR_SIZE_TUPLE(22), UQR_SIZE_TUPLE(23), UQR_SIZE_TUPLE(24), UQR_SIZE_TUPLE(25),
+    UQR_SIZE_TUPLE(26), UQR_SIZE_TUPLE(27), UQR_SIZE_TUPLE(28), UQR_SIZE_TUPLE(29), UQR_SIZE_TUPLE(30),
+    UQR_SIZE_TUPLE(31), UQR_SIZE_TUPLE(32), UQR_SIZE_TUPLE(33), UQR_SIZE_TUPLE(34), UQR_SIZE_TUPLE(35),
+    UQR_SIZE_TUPLE(36), UQR_SIZE_TUPLE(37), UQR_SIZE_TUPLE(38), UQR_SIZE_TUPLE(39), UQR_SIZE_TUPLE(40),
+};
+
+// rendered_qr_packed_into()
 //
-// Read pixel (module) colour at X, Y
+// Same pixels as packed(), but written into a caller's buffer (a framebuffer, say)
+// instead of a new bytes object. Rows start every stride bytes (default: packed
+// right after each other); only the bytes of the QR's row are written, whole bytes
+// with the padding clear (or set, when inverted). Returns (W, H) without allocating.
 //
-    STATIC mp_obj_t 
-rendered_qr_get(mp_obj_t self_in, mp_obj_t x_in, mp_obj_t y_in) {
-    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
+    STATIC mp_obj_t
+rendered_qr_packed_into(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum {ARG_buf, ARG_stride, ARG_invert};
+    const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_OBJ|MP_ARG_REQUIRED, {}},
+        { MP_QSTR_stride, MP_ARG_OBJ, { .u_obj = MP_OBJ_NULL } },
+        { MP_QSTR_invert, MP_ARG_BOOL, { .u_bool = false } },
+    };
 
-    mp_int_t x = mp_obj_get_int(x_in);
-    mp_int_t y = mp_obj_get_int(y_in);
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(pos_args[0]);
 
-    bool rv = qrcodegen_getModule(self->rendered, x, y);
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
 
-    return rv ? mp_const_true : mp_const_false;
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_WRITE);
+
+    int w = self->width;
+    size_t row_len = UQR_STRIDE(w);
+    size_t stride = row_len;
+
+    if(args[ARG_stride].u_obj != MP_OBJ_NULL && args[ARG_stride].u_obj != mp_const_none) {
+        mp_int_t st = mp_obj_get_int(args[ARG_stride].u_obj);
+        if(st < (mp_int_t)row_len || (mp_uint_t)st > bufinfo.len) {
+            mp_raise_ValueError(MP_ERROR_TEXT("stride"));
+        }
+        stride = st;
+    }
+
+    // no multiplying before the check: stride * (w - 1) could wrap on 32-bit ports
+    if(bufinfo.len < row_len || stride > (bufinfo.len - row_len) / (w - 1)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf"));
+    }
+
+    const uint8_t *src = self->rendered;
+    uint8_t *dest = bufinfo.buf;
+
+    if(!args[ARG_invert].u_bool && stride == row_len) {
+        memcpy(dest, src, row_len * w);
+    } else {
+        uint8_t flip = args[ARG_invert].u_bool ? 0xff : 0;
+
+        for(int y=0; y < w; y++, src += row_len, dest += stride) {
+            for(size_t i=0; i < row_len; i++) {
+                dest[i] = src[i] ^ flip;
+            }
+        }
+    }
+
+    return MP_OBJ_FROM_PTR(&uqr_size_tuples[(w - 17) / 4 - 1]);
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_3(rendered_qr_get_obj, rendered_qr_get);
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(rendered_qr_packed_into_obj, 2, rendered_qr_packed_into);
+
+// Largest quiet zone render_into() draws, in modules.
+#define UQR_BORDER_MAX      64
+
+// Bits for a run of s equal pixels, and for the 4 modules of a nibble (MSB first)
+// each stretched to s pixels.
+#define UQR_RUN(s)          ((1u << (s)) - 1)
+#define UQR_EXPAND(s, n)    ((((n) & 8) ? UQR_RUN(s) << (3 * (s)) : 0)    \
+                            | (((n) & 4) ? UQR_RUN(s) << (2 * (s)) : 0)   \
+                            | (((n) & 2) ? UQR_RUN(s) << (s) : 0)         \
+                            | (((n) & 1) ? UQR_RUN(s) : 0))
+#define UQR_EXPAND_ROW(s)   {                                                       \
+        UQR_EXPAND(s, 0),  UQR_EXPAND(s, 1),  UQR_EXPAND(s, 2),  UQR_EXPAND(s, 3),  \
+        UQR_EXPAND(s, 4),  UQR_EXPAND(s, 5),  UQR_EXPAND(s, 6),  UQR_EXPAND(s, 7),  \
+        UQR_EXPAND(s, 8),  UQR_EXPAND(s, 9),  UQR_EXPAND(s, 10), UQR_EXPAND(s, 11), \
+        UQR_EXPAND(s, 12), UQR_EXPAND(s, 13), UQR_EXPAND(s, 14), UQR_EXPAND(s, 15) }
+
+// Nibble expansions for scales 2 to 8 (448 bytes).
+STATIC const uint32_t uqr_expand[7][16] = {
+    UQR_EXPAND_ROW(2), UQR_EXPAND_ROW(3), UQR_EXPAND_ROW(4), UQR_EXPAND_ROW(5),
+    UQR_EXPAND_ROW(6), UQR_EXPAND_ROW(7), UQR_EXPAND_ROW(8),
+};
 
-// mp_obj_rendered_qr_print()
+// Writes a row of 1-bit pixels, MSB first, starting at any bit. Bits outside
+// what is written are kept.
+typedef struct _uqr_bit_writer_t {
+    uint8_t     *p;
+    uint32_t    acc;
+    int         n;          // bits held in acc, under 8 between calls
+} uqr_bit_writer_t;
+
+// uqr_bits_start()
 //
-// Printer (for fun)
+// Start writing at bit pos of row, keeping the bits in front of it.
 //
-    void
-mp_obj_rendered_qr_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
-    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
-    (void)kind;
-
-    int w = qrcodegen_getSize(self->rendered);
+    static inline void
+uqr_bits_start(uqr_bit_writer_t *bw, uint8_t *row, size_t pos)
+{
+    bw->p = row + (pos >> 3);
+    bw->n = pos & 7;
+    bw->acc = bw->n ? (*bw->p >> (8 - bw->n)) : 0;
+}
 
-    for(int y=0; y < w; y++) {
-        for(int x=0; x < w; x++) {
-            char *ch = qrcodegen_getModule(self->rendered, x, y) ? "##" : "  ";
-            mp_print_str(print, ch);
-        }
+// uqr_bits_put()
+//
+// Append the low count bits of bits, count up to 24.
+//
+    static inline void
+uqr_bits_put(uqr_bit_writer_t *bw, uint32_t bits, int count)
+{
+    bw->acc = (bw->acc << count) | bits;
+    bw->n += count;
 
-        mp_print_str(print, "\n");
+    while(bw->n >= 8) {
+        bw->n -= 8;
+        *(bw->p++) = bw->acc >> bw->n;
     }
 }
 
-// rendered_qr_del()
+// uqr_bits_run()
 //
-// Finalializer. Needs to free the rendered QR data.
+// Append count pixels of one colour.
 //
-    STATIC mp_obj_t
-rendered_qr_del(mp_obj_t self_in) {
-    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
-
-    if(self->rendered) {
-#if MICROPY_MALLOC_USES_ALLOCATED_SIZE
-        free((void *)self->rendered);
-#else
-        m_free((void *)self->rendered);
-#endif
-        self->rendered = NULL;
+    STATIC void
+uqr_bits_run(uqr_bit_writer_t *bw, bool on, int count)
+{
+    for(; count > 16; count -= 16) {
+        uqr_bits_put(bw, on ? 0xffff : 0, 16);
     }
+    uqr_bits_put(bw, on ? UQR_RUN(count) : 0, count);
+}
 
-    return mp_const_none;
+// uqr_bits_finish()
+//
+// Write out the last partial byte, keeping the bits after it.
+//
+    STATIC void
+uqr_bits_finish(uqr_bit_writer_t *bw)
+{
+    if(bw->n) {
+        uint8_t keep = 0xff >> bw->n;
+        *bw->p = ((uint8_t)(bw->acc << (8 - bw->n)) & ~keep) | (*bw->p & keep);
+    }
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_1(rendered_qr_del_obj, rendered_qr_del);
 
-#if !MICROPY_ENABLE_DYNRUNTIME
-STATIC const mp_rom_map_elem_t rendered_qr_locals_dict_table[] = {
-    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&rendered_qr_del_obj) },
-    { MP_ROM_QSTR(MP_QSTR_width), MP_ROM_PTR(&rendered_qr_width_obj) },
-    { MP_ROM_QSTR(MP_QSTR_get), MP_ROM_PTR(&rendered_qr_get_obj) },
-    { MP_ROM_QSTR(MP_QSTR_packed), MP_ROM_PTR(&rendered_qr_packed_obj) },
-    { MP_ROM_QSTR(MP_QSTR_version), MP_ROM_PTR(&rendered_qr_version_obj) },
-};
-STATIC MP_DEFINE_CONST_DICT(rendered_qr_locals_dict, rendered_qr_locals_dict_table);
+// uqr_module_line()
+//
+// One row of modules with the quiet zone each side, 1 bit per module MSB first, into line.
+// Rows above and below the QR are all quiet zone.
+//
+    STATIC void
+uqr_module_line(const mp_obj_rendered_qr_t *qr, int my, int border, bool invert, uint8_t *line)
+{
+    int w = qr->width;
+    uint8_t flip = invert ? 0xff : 0;
+    uqr_bit_writer_t bw;
 
-#if (MICROPY_VERSION_MAJOR == 1) && (MICROPY_VERSION_MINOR < 20)
-STATIC const mp_obj_type_t mp_type_rendered_qr = {
-    { &mp_type_type },
-    .name = MP_QSTR_RenderedQR,
-    .make_new = rendered_qr_make_new,
-    .print = mp_obj_rendered_qr_print,
-    .locals_dict = (mp_obj_dict_t *)&rendered_qr_locals_dict,
-};
-#else
-STATIC MP_DEFINE_CONST_OBJ_TYPE(
-    mp_type_rendered_qr,
-    MP_QSTR_RenderedQR,
-    MP_TYPE_FLAG_NONE,
-    make_new, rendered_qr_make_new,
-    print, mp_obj_rendered_qr_print,
-    locals_dict, &rendered_qr_locals_dict
-);
-#endif
-#endif
+    uqr_bits_start(&bw, line, 0);
+    uqr_bits_run(&bw, invert, border);
 
+    if(my >= 0 && my < w) {
+        const uint8_t *row = qr->rendered + my * UQR_STRIDE(w);
+        int x = 0;
 
-#if !MICROPY_ENABLE_DYNRUNTIME
-STATIC const mp_rom_map_elem_t mp_module_uqr_globals_table[] = {
-    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_uqr) },
+        for(; x + 8 <= w; x += 8) {
+            uqr_bits_put(&bw, *(row++) ^ flip, 8);
+        }
+        uqr_bits_put(&bw, (uint8_t)(*row ^ flip) >> (8 - (w - x)), w - x);
+    } else {
+        uqr_bits_run(&bw, invert, w);
+    }
 
-    // Constants
-    // error levels
+    uqr_bits_run(&bw, invert, border);
+    uqr_bits_finish(&bw);
+}
+
+// uqr_scale_line()
+//
+// Write pixels c0 to c0+n-1 of a module line stretched by scale. Whole bytes of
+// modules are copied at scale 1, and nibbles expanded from tables at 2 to 8.
+//
+    STATIC void
+uqr_scale_line(uqr_bit_writer_t *bw, const uint8_t *line, int scale, int c0, int n)
+{
+    #define MODULE(m)   ((line[(m) >> 3] >> (7 - ((m) & 7))) & 1)
+
+    int m = c0 / scale;
+    int part = c0 % scale;
+
+    if(part) {
+        // first module is cut by the viewport
+        int k = (scale - part < n) ? (scale - part) : n;
+        uqr_bits_run(bw, MODULE(m), k);
+        n -= k;
+        m++;
+    }
+
+    while(n >= scale) {
+        if(scale == 1 && !(m & 7) && n >= 8) {
+            uqr_bits_put(bw, line[m >> 3], 8);
+            m += 8;
+            n -= 8;
+        } else if(scale >= 2 && scale <= 8 && !(m & 3) && n >= 4 * scale) {
+            uint32_t bits = uqr_expand[scale - 2][(line[m >> 3] >> ((m & 4) ? 0 : 4)) & 0xf];
+
+            if(scale > 6) {
+                uqr_bits_put(bw, bits >> 16, 4 * scale - 16);
+                uqr_bits_put(bw, bits & 0xffff, 16);
+            } else {
+                uqr_bits_put(bw, bits, 4 * scale);
+            }
+            m += 4;
+            n -= 4 * scale;
+        } else {
+            uqr_bits_run(bw, MODULE(m), scale);
+            m++;
+            n -= scale;
+        }
+    }
+
+    if(n) {
+        // last module, cut
+        uqr_bits_run(bw, MODULE(m), n);
+    }
+
+    #undef MODULE
+}
+
+// uqr_copy_bits()
+//
+// Copy count bits starting at bit pos from one row to another, keeping the bits around them.
+// Bits are numbered from the MSB of each byte, or from the LSB if lsb_first.
+//
+    STATIC void
+uqr_copy_bits(uint8_t *dest, const uint8_t *src, size_t pos, size_t count, bool lsb_first)
+{
+    size_t b0 = pos >> 3;
+    size_t b1 = (pos + count - 1) >> 3;
+    uint8_t head, tail;
+
+    if(lsb_first) {
+        head = 0xff << (pos & 7);
+        tail = 0xff >> (7 - ((pos + count - 1) & 7));
+    } else {
+        head = 0xff >> (pos & 7);
+        tail = 0xff << (7 - ((pos + count - 1) & 7));
+    }
+
+    if(b0 == b1) {
+        head &= tail;
+        dest[b0] = (dest[b0] & ~head) | (src[b0] & head);
+        return;
+    }
+
+    dest[b0] = (dest[b0] & ~head) | (src[b0] & head);
+    memcpy(dest + b0 + 1, src + b0 + 1, b1 - b0 - 1);
+    dest[b1] = (dest[b1] & ~tail) | (src[b1] & tail);
+}
+
+// Pixel formats render_into() can write; same numbers as MicroPython's framebuf module.
+#define UQR_MONO_VLSB       0
+#define UQR_RGB565          1
+#define UQR_GS4_HMSB        2
+#define UQR_MONO_HLSB       3
+#define UQR_MONO_HMSB       4
+#define UQR_GS2_HMSB        5
+
+// Bits per pixel of each format, by number.
+STATIC const uint8_t uqr_format_bpp[] = { 1, 16, 4, 1, 1, 2 };
+
+// Where render_into() draws: buffer, format, bytes per row (per 8-row page for
+// MONO_VLSB), and the grey/colour formats' values for light and dark pixels,
+// also expanded for 4 pixels (a nibble of a scaled row) at a time.
+typedef struct _uqr_target_t {
+    uint8_t     *buf;
+    size_t      stride;
+    int         fmt;
+    uint16_t    color[2];       // [light, dark]; RGB565 already in byte order
+    uint8_t     gs2[16];        // one byte
+    uint16_t    gs4[16];        // two bytes, first in the high half
+} uqr_target_t;
+
+// uqr_target_tables()
+//
+// Fill in the 4-pixel tables from the colours.
+//
+    STATIC void
+uqr_target_tables(uqr_target_t *t)
+{
+    for(int nib = 0; nib < 16; nib++) {
+        uint8_t g2 = 0;
+        uint16_t g4 = 0;
+
+        for(int j = 0; j < 4; j++) {
+            int on = (nib >> (3 - j)) & 1;          // first pixel in the MSB
+
+            g2 |= (t->color[on] & 0x3) << (2 * j);      // first pixel in the low bits
+            g4 |= (t->color[on] & 0xf) << (12 - 4 * j); // first pixel in the high nibble
+        }
+
+        t->gs2[nib] = g2;
+        t->gs4[nib] = g4;
+    }
+}
+
+// uqr_convert()
+//
+// Write n pixels of a scaled row (1 bit each, MSB first) to row py of the target,
+// from pixel px. Whole groups are table lookups once the destination is aligned.
+//
+    STATIC void
+uqr_convert(const uqr_target_t *t, size_t py, size_t px, const uint8_t *bits, int n)
+{
+    #define BIT(i)      ((bits[(i) >> 3] >> (7 - ((i) & 7))) & 1)
+    #define NIBBLE(i)   ((bits[(i) >> 3] >> (((i) & 4) ? 0 : 4)) & 0xf)
+
+    uint8_t *row = t->buf + py * t->stride;
+    int i = 0;
+
+    switch(t->fmt) {
+        case UQR_MONO_HMSB:
+            while(i < n) {
+                size_t p = px + i;
+
+                if(!(p & 7) && !(i & 7) && n - i >= 8) {
+                    uint8_t v = bits[i >> 3];       // reverse the bit order
+
+                    v = ((v & 0xf0) >> 4) | ((v & 0x0f) << 4);
+                    v = ((v & 0xcc) >> 2) | ((v & 0x33) << 2);
+                    v = ((v & 0xaa) >> 1) | ((v & 0x55) << 1);
+                    row[p >> 3] = v;
+                    i += 8;
+                } else {
+                    uint8_t m = 1 << (p & 7);
+
+                    row[p >> 3] = BIT(i) ? (row[p >> 3] | m) : (row[p >> 3] & ~m);
+                    i++;
+                }
+            }
+            break;
+
+        case UQR_MONO_VLSB: {
+            uint8_t m = 1 << (py & 7);
+
+            row = t->buf + (py >> 3) * t->stride + px;
+            for(; i < n; i++) {
+                row[i] = BIT(i) ? (row[i] | m) : (row[i] & ~m);
+            }
+            break;
+        }
+
+        case UQR_GS2_HMSB:
+            while(i < n) {
+                size_t p = px + i;
+
+                if(!(p & 3) && !(i & 3) && n - i >= 4) {
+                    row[p >> 2] = t->gs2[NIBBLE(i)];
+                    i += 4;
+                } else {
+                    int shift = (p & 3) * 2;
+
+                    row[p >> 2] = (row[p >> 2] & ~(0x3 << shift))
+                                    | ((t->color[BIT(i)] & 0x3) << shift);
+                    i++;
+                }
+            }
+            break;
+
+        case UQR_GS4_HMSB:
+            while(i < n) {
+                size_t p = px + i;
+
+                if(!(p & 1) && !(i & 3) && n - i >= 4) {
+                    uint16_t v = t->gs4[NIBBLE(i)];
+
+                    row[p >> 1] = v >> 8;
+                    row[(p >> 1) + 1] = v & 0xff;
+                    i += 4;
+                } else {
+                    int shift = (p & 1) ? 0 : 4;
+
+                    row[p >> 1] = (row[p >> 1] & ~(0xf << shift))
+                                    | ((t->color[BIT(i)] & 0xf) << shift);
+                    i++;
+                }
+            }
+            break;
+
+        case UQR_RGB565:
+            row += px * 2;
+            for(; i < n; i++) {
+                uint16_t c = t->color[BIT(i)];
+
+                *(row++) = c & 0xff;
+                *(row++) = c >> 8;
+            }
+            break;
+    }
+
+    #undef BIT
+    #undef NIBBLE
+}
+
+// uqr_draw_row()
+//
+// Draw pixels c0 to c0+n-1 of a scaled module line into row py of the target, from pixel px.
+// MONO_HLSB is written directly; other formats go through a 1-bit row, a chunk at a time.
+//
+    STATIC void
+uqr_draw_row(const uqr_target_t *t, size_t py, size_t px, const uint8_t *line, int scale, int c0, int n)
+{
+    uqr_bit_writer_t bw;
+
+    if(t->fmt == UQR_MONO_HLSB) {
+        uqr_bits_start(&bw, t->buf + py * t->stride, px);
+        uqr_scale_line(&bw, line, scale, c0, n);
+        uqr_bits_finish(&bw);
+        return;
+    }
+
+    uint8_t chunk[32] = { 0 };
+
+    for(int done = 0; done < n; ) {
+        int k = (n - done < (int)(8 * sizeof(chunk))) ? (n - done) : (int)(8 * sizeof(chunk));
+
+        uqr_bits_start(&bw, chunk, 0);
+        uqr_scale_line(&bw, line, scale, c0 + done, k);
+        uqr_bits_finish(&bw);
+
+        uqr_convert(t, py, px + done, chunk, k);
+        done += k;
+    }
+}
+
+// uqr_check_scale()
+//
+// Range check the scale and quiet zone for drawing.
+//
+    STATIC void
+uqr_check_scale(mp_int_t scale, mp_int_t border)
+{
+    if(scale < 1 || scale > 255) {
+        mp_raise_ValueError(MP_ERROR_TEXT("scale"));
+    }
+    if(border < 0 || border > UQR_BORDER_MAX) {
+        mp_raise_ValueError(MP_ERROR_TEXT("border"));
+    }
+}
+
+// uqr_target_init()
+//
+// Check the format and set the pixel values for it, from colors=(dark, light) or None,
+// and swap. The caller fills in the buffer and stride.
+//
+    STATIC void
+uqr_target_init(uqr_target_t *t, mp_int_t fmt, mp_obj_t colors, bool swap)
+{
+    if(fmt < 0 || fmt >= (mp_int_t)MP_ARRAY_SIZE(uqr_format_bpp)) {
+        mp_raise_ValueError(MP_ERROR_TEXT("fmt"));
+    }
+
+    int bpp = uqr_format_bpp[fmt];
+
+    t->fmt = fmt;
+    t->color[1] = (1u << bpp) - 1;      // dark modules: all bits set, like packed()
+    t->color[0] = 0;
+
+    if(colors != MP_OBJ_NULL && colors != mp_const_none) {
+        mp_obj_t *items;
+        mp_obj_get_array_fixed_n(colors, 2, &items);
+        t->color[1] = mp_obj_get_int(items[0]) & ((1u << bpp) - 1);
+        t->color[0] = mp_obj_get_int(items[1]) & ((1u << bpp) - 1);
+    }
+    if(fmt == UQR_RGB565 && swap) {
+        for(int i = 0; i < 2; i++) {
+            t->color[i] = (t->color[i] >> 8) | (t->color[i] << 8);
+        }
+    }
+    if(fmt == UQR_GS2_HMSB || fmt == UQR_GS4_HMSB) {
+        uqr_target_tables(t);
+    }
+}
+
+// rendered_qr_render_into()
+//
+// Draw the QR, scaled and with a quiet zone, into a buffer in one of framebuf's pixel
+// formats (default MONO_HLSB) at pixel x, y. A viewport (vx, vy, vw, vh) in pixels of the
+// scaled image picks the part to draw, to page through big QR's on a small screen. Only
+// the pixels drawn are changed.
+//
+    STATIC mp_obj_t
+rendered_qr_render_into(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum {ARG_buf, ARG_x, ARG_y, ARG_scale, ARG_border, ARG_invert, ARG_viewport, ARG_stride,
+            ARG_fmt, ARG_colors, ARG_swap};
+    const mp_arg_t allowed_args[] = {
+        { MP_QSTR_buf, MP_ARG_OBJ|MP_ARG_REQUIRED, {}},
+        { MP_QSTR_x, MP_ARG_INT, { .u_int = 0 } },
+        { MP_QSTR_y, MP_ARG_INT, { .u_int = 0 } },
+        { MP_QSTR_scale, MP_ARG_INT, { .u_int = 1 } },
+        { MP_QSTR_border, MP_ARG_INT, { .u_int = 4 } },
+        { MP_QSTR_invert, MP_ARG_BOOL, { .u_bool = false } },
+        { MP_QSTR_viewport, MP_ARG_OBJ, { .u_obj = MP_OBJ_NULL } },
+        { MP_QSTR_stride, MP_ARG_OBJ, { .u_obj = MP_OBJ_NULL } },
+        { MP_QSTR_fmt, MP_ARG_INT, { .u_int = UQR_MONO_HLSB } },
+        { MP_QSTR_colors, MP_ARG_OBJ, { .u_obj = MP_OBJ_NULL } },
+        { MP_QSTR_swap, MP_ARG_BOOL, { .u_bool = false } },
+    };
+
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(args[ARG_buf].u_obj, &bufinfo, MP_BUFFER_WRITE);
+
+    mp_int_t x = args[ARG_x].u_int;
+    mp_int_t y = args[ARG_y].u_int;
+    mp_int_t scale = args[ARG_scale].u_int;
+    mp_int_t border = args[ARG_border].u_int;
+    bool invert = args[ARG_invert].u_bool;
+    mp_int_t fmt = args[ARG_fmt].u_int;
+
+    // a pixel needs at least a bit, so an x or y past len * 8 can never fit
+    if(x < 0 || y < 0 || (mp_uint_t)x / 8 > bufinfo.len || (mp_uint_t)y / 8 > bufinfo.len) {
+        mp_raise_ValueError(MP_ERROR_TEXT("x, y"));
+    }
+    uqr_check_scale(scale, border);
+
+    uqr_target_t target;
+    uqr_target_init(&target, fmt, args[ARG_colors].u_obj, args[ARG_swap].u_bool);
+    target.buf = bufinfo.buf;
+
+    int bpp = uqr_format_bpp[fmt];
+
+    // whole image, then the part of it to draw
+    int w = self->width;
+    mp_int_t full = (w + 2 * border) * scale;
+    mp_int_t vx = 0, vy = 0, vw = full, vh = full;
+
+    if(args[ARG_viewport].u_obj != MP_OBJ_NULL && args[ARG_viewport].u_obj != mp_const_none) {
+        mp_obj_t *items;
+        mp_obj_get_array_fixed_n(args[ARG_viewport].u_obj, 4, &items);
+        vx = mp_obj_get_int(items[0]);
+        vy = mp_obj_get_int(items[1]);
+        vw = mp_obj_get_int(items[2]);
+        vh = mp_obj_get_int(items[3]);
+
+        if(vx < 0 || vy < 0 || vw < 0 || vh < 0) {
+            mp_raise_ValueError(MP_ERROR_TEXT("viewport"));
+        }
+
+        // clip to the image
+        vw = (vx >= full) ? 0 : (vw < full - vx) ? vw : (full - vx);
+        vh = (vy >= full) ? 0 : (vh < full - vy) ? vh : (full - vy);
+    }
+
+    // Bytes used in each row; MONO_VLSB has a byte per column in each 8-row page. Sizes
+    // are worked out in 64 bits, since a large x, y or stride would wrap a 32-bit size_t
+    // and let a small buffer pass. Once checked against the buffer, they all fit.
+    bool vertical = (fmt == UQR_MONO_VLSB);
+    uint64_t row_len = vertical ? (uint64_t)x + vw : (((uint64_t)x + vw) * bpp + 7) / 8;
+    uint64_t stride = row_len;
+
+    if(args[ARG_stride].u_obj != MP_OBJ_NULL && args[ARG_stride].u_obj != mp_const_none) {
+        mp_int_t st = mp_obj_get_int(args[ARG_stride].u_obj);
+        if(st < 0 || (uint64_t)st < row_len || (mp_uint_t)st > bufinfo.len) {
+            mp_raise_ValueError(MP_ERROR_TEXT("stride"));
+        }
+        stride = st;
+    }
+
+    if(!vw || !vh) {
+        return mp_const_none;
+    }
+
+    uint64_t last_row = vertical ? ((uint64_t)y + vh - 1) / 8 : (uint64_t)y + vh - 1;
+    if(row_len > bufinfo.len || last_row * stride + row_len > bufinfo.len) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf"));
+    }
+    target.stride = stride;
+
+    uint8_t line[UQR_STRIDE(qrcodegen_VERSION_MAX * 4 + 17 + 2 * UQR_BORDER_MAX)];
+
+    // pixel 0 of a row is bit 0 from the LSB in these formats
+    bool lsb_first = (fmt == UQR_MONO_HMSB || fmt == UQR_GS2_HMSB);
+
+    for(mp_int_t r = 0; r < vh; ) {
+        // draw one row of modules, then copy it for the other rows of that module
+        mp_int_t reps = scale - (vy + r) % scale;
+        if(reps > vh - r) {
+            reps = vh - r;
+        }
+
+        uqr_module_line(self, (vy + r) / scale - border, border, invert, line);
+        uqr_draw_row(&target, y + r, x, line, scale, vx, vw);
+
+        const uint8_t *first = target.buf + (y + r) * target.stride;
+
+        for(mp_int_t k = 1; k < reps; k++) {
+            if(vertical) {
+                uqr_draw_row(&target, y + r + k, x, line, scale, vx, vw);
+            } else {
+                uqr_copy_bits(target.buf + (y + r + k) * target.stride, first,
+                                x * bpp, vw * bpp, lsb_first);
+            }
+        }
+
+        r += reps;
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(rendered_qr_render_into_obj, 2, rendered_qr_render_into);
+
+// Iterator from RenderedQR.rows(): one scaled row (or 8-row page, for MONO_VLSB) at a time,
+// always in the same buffer. Works as a polymorph iterator, so no type of its own.
+typedef struct _uqr_rows_iter_t {
+    mp_obj_base_t   base;
+    mp_fun_1_t      iternext;
+
+    mp_obj_t        qr;         // the RenderedQR, kept alive while iterating
+    mp_obj_t        row;        // buffer returned each time
+    size_t          row_len;
+    uqr_target_t    target;
+
+    unsigned int    generation; // of the QR when started
+    int             width;
+    int             scale;
+    int             border;
+    bool            invert;
+    int             full;       // pixels each way, with quiet zone
+    int             y;          // next pixel row
+    int             line_y;     // module row in line, or below -border if none yet
+    uint8_t         line[UQR_STRIDE(qrcodegen_VERSION_MAX * 4 + 17 + 2 * UQR_BORDER_MAX)];
+} uqr_rows_iter_t;
+
+// uqr_rows_iternext()
+//
+// Draw the next row into the row buffer and return it.
+//
+    STATIC mp_obj_t
+uqr_rows_iternext(mp_obj_t self_in)
+{
+    uqr_rows_iter_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_rendered_qr_t *qr = MP_OBJ_TO_PTR(self->qr);
+
+    if(self->y >= self->full) {
+        return MP_OBJ_STOP_ITERATION;
+    }
+    if(qr->generation != self->generation) {
+        // re-encoded by Encoder.encode(out=...) part way through
+        mp_raise_ValueError(MP_ERROR_TEXT("QR changed"));
+    }
+
+    // fetch it every time, in case the buffer has moved
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(self->row, &bufinfo, MP_BUFFER_WRITE);
+    if(bufinfo.len < self->row_len) {
+        mp_raise_ValueError(MP_ERROR_TEXT("buf"));
+    }
+    self->target.buf = bufinfo.buf;
+
+    bool vertical = (self->target.fmt == UQR_MONO_VLSB);
+    int count = vertical ? 8 : 1;
+
+    if(vertical) {
+        // rows past the end of the last page are left clear
+        memset(bufinfo.buf, 0, self->row_len);
+    }
+
+    for(int k = 0; k < count && self->y < self->full; k++, self->y++) {
+        int my = self->y / self->scale - self->border;
+
+        if(my != self->line_y) {
+            uqr_module_line(qr, my, self->border, self->invert, self->line);
+            self->line_y = my;
+        }
+
+        uqr_draw_row(&self->target, k, 0, self->line, self->scale, 0, self->full);
+    }
+
+    return self->row;
+}
+
+// rendered_qr_rows()
+//
+// Return an iterator over the rows of the scaled QR with a quiet zone, in a pixel
+// format of render_into(). Each row is drawn into the same buffer (buf=, or one
+// bytearray made here) just before it is returned, so memory is one row, not an image.
+//
+    STATIC mp_obj_t
+rendered_qr_rows(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum {ARG_scale, ARG_border, ARG_fmt, ARG_invert, ARG_colors, ARG_swap, ARG_buf};
+    const mp_arg_t allowed_args[] = {
+        { MP_QSTR_scale, MP_ARG_INT, { .u_int = 1 } },
+        { MP_QSTR_border, MP_ARG_INT, { .u_int = 0 } },
+        { MP_QSTR_fmt, MP_ARG_INT, { .u_int = UQR_MONO_HLSB } },
+        { MP_QSTR_invert, MP_ARG_BOOL, { .u_bool = false } },
+        { MP_QSTR_colors, MP_ARG_OBJ, { .u_obj = MP_OBJ_NULL } },
+        { MP_QSTR_swap, MP_ARG_BOOL, { .u_bool = false } },
+        { MP_QSTR_buf, MP_ARG_OBJ, { .u_obj = MP_OBJ_NULL } },
+    };
+
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_int_t scale = args[ARG_scale].u_int;
+    mp_int_t border = args[ARG_border].u_int;
+    uqr_check_scale(scale, border);
+
+    uqr_rows_iter_t *it = m_new_obj(uqr_rows_iter_t);
+    it->base.type = &mp_type_polymorph_iter;
+    it->iternext = uqr_rows_iternext;
+
+    uqr_target_init(&it->target, args[ARG_fmt].u_int, args[ARG_colors].u_obj, args[ARG_swap].u_bool);
+
+    it->qr = pos_args[0];
+    it->generation = self->generation;
+    it->width = self->width;
+    it->scale = scale;
+    it->border = border;
+    it->invert = args[ARG_invert].u_bool;
+    it->full = (it->width + 2 * border) * scale;
+    it->y = 0;
+    it->line_y = -border - 1;
+
+    // one row, or for MONO_VLSB one page of 8 rows: a byte per column
+    it->row_len = (it->target.fmt == UQR_MONO_VLSB) ? (size_t)it->full
+                        : ((size_t)it->full * uqr_format_bpp[it->target.fmt] + 7) / 8;
+    it->target.stride = it->row_len;
+
+    if(args[ARG_buf].u_obj != MP_OBJ_NULL && args[ARG_buf].u_obj != mp_const_none) {
+        it->row = args[ARG_buf].u_obj;
+    } else {
+        it->row = mp_obj_new_bytearray_by_ref(it->row_len, m_new0(byte, it->row_len));
+    }
+
+    return MP_OBJ_FROM_PTR(it);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(rendered_qr_rows_obj, 1, rendered_qr_rows);
+
+// rendered_qr_get_buffer()
+//
+// Buffer protocol: the QR's rows as packed() returns them (see layout()), so
+// memoryview(qr) reads the modules without copies. Read-only: get(), packed() and
+// the rest would hand out whatever a write left behind.
+//
+    STATIC mp_int_t
+rendered_qr_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags)
+{
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
+
+    if(flags & MP_BUFFER_WRITE) {
+        return 1;
+    }
+
+    int w = self->width;
+
+    bufinfo->buf = self->rendered;
+    bufinfo->len = UQR_STRIDE(w) * w;
+    bufinfo->typecode = 'B';
+
+    self->exported = true;
+
+    return 0;
+}
+
+// rendered_qr_layout()
+//
+// Describe the buffer: (size, stride, format). Size is the width and height in modules,
+// stride the bytes per row, and format uqr.MONO_HLSB: 8 modules per byte, MSB first,
+// 1 for dark.
+//
+    STATIC mp_obj_t
+rendered_qr_layout(mp_obj_t self_in)
+{
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
+
+    int w = self->width;
+    mp_obj_t items[3] = {
+        MP_OBJ_NEW_SMALL_INT(w),
+        MP_OBJ_NEW_SMALL_INT(UQR_STRIDE(w)),
+        MP_OBJ_NEW_SMALL_INT(UQR_MONO_HLSB),
+    };
+
+    return mp_obj_new_tuple(3, items);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(rendered_qr_layout_obj, rendered_qr_layout);
+
+// rendered_qr_get()
+//
+// Read pixel (module) colour at X, Y
+//
+    STATIC mp_obj_t 
+rendered_qr_get(mp_obj_t self_in, mp_obj_t x_in, mp_obj_t y_in) {
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
+
+    mp_int_t x = mp_obj_get_int(x_in);
+    mp_int_t y = mp_obj_get_int(y_in);
+
+    bool rv = uqr_get_module(self, x, y);
+
+    return rv ? mp_const_true : mp_const_false;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(rendered_qr_get_obj, rendered_qr_get);
+
+// Console output is gathered into a buffer this big and written a line (or this many
+// bytes) at a time, instead of a call per module.
+#define UQR_PRINT_BUF_LEN   192
+
+typedef struct _uqr_line_printer_t {
+    const mp_print_t    *print;
+    size_t              n;
+    char                buf[UQR_PRINT_BUF_LEN];
+} uqr_line_printer_t;
+
+// uqr_print_flush()
+//
+// Write out what has been gathered.
+//
+    STATIC void
+uqr_print_flush(uqr_line_printer_t *lp)
+{
+    if(lp->n) {
+        lp->print->print_strn(lp->print->data, lp->buf, lp->n);
+        lp->n = 0;
+    }
+}
+
+// uqr_print_add()
+//
+// Gather len bytes of text (at most a few), flushing first if they don't fit.
+//
+    static inline void
+uqr_print_add(uqr_line_printer_t *lp, const char *str, size_t len)
+{
+    if(lp->n + len > sizeof(lp->buf)) {
+        uqr_print_flush(lp);
+    }
+    memcpy(lp->buf + lp->n, str, len);
+    lp->n += len;
+}
+
+// uqr_print_qr()
+//
+// Print the QR with a quiet zone of border modules. With half_blocks, two rows of modules
+// go on each line, using the Unicode half and full blocks; otherwise each module is
+// two characters, "##" or spaces. Ink is dark modules, or light ones if inverted.
+//
+    STATIC void
+uqr_print_qr(const mp_print_t *print, const mp_obj_rendered_qr_t *qr, int border, bool invert, bool half_blocks)
+{
+    // [top][bottom] modules inked
+    static const char *const glyphs[2][2] = {
+        { " ", "\xe2\x96\x84" },                 // space, lower half
+        { "\xe2\x96\x80", "\xe2\x96\x88" },      // upper half, full block
+    };
+
+    uqr_line_printer_t lp;
+    int w = qr->width;
+
+    lp.print = print;
+    lp.n = 0;
+
+    for(int y = -border; y < w + border; y += half_blocks ? 2 : 1) {
+        for(int x = -border; x < w + border; x++) {
+            bool top = uqr_get_module(qr, x, y) ^ invert;
+
+            if(half_blocks) {
+                // past the last row is no ink, whatever invert says
+                bool bottom = (y + 1 < w + border) && (uqr_get_module(qr, x, y + 1) ^ invert);
+                const char *g = glyphs[top][bottom];
+
+                uqr_print_add(&lp, g, strlen(g));
+            } else {
+                uqr_print_add(&lp, top ? "##" : "  ", 2);
+            }
+        }
+
+        uqr_print_add(&lp, "\n", 1);
+        uqr_print_flush(&lp);
+    }
+}
+
+// mp_obj_rendered_qr_print()
+//
+// Printer (for fun)
+//
+    void
+mp_obj_rendered_qr_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
+    (void)kind;
+
+    uqr_print_qr(print, self, 0, false, false);
+}
+
+// rendered_qr_show()
+//
+// Print the QR to the console, two rows of modules per line with Unicode half blocks,
+// or as print() does when ascii. Scans much better with a quiet zone (border, in modules).
+// Use invert on terminals with light text on a dark background.
+//
+    STATIC mp_obj_t
+rendered_qr_show(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum {ARG_border, ARG_invert, ARG_ascii};
+    const mp_arg_t allowed_args[] = {
+        { MP_QSTR_border, MP_ARG_INT, { .u_int = 4 } },
+        { MP_QSTR_invert, MP_ARG_BOOL, { .u_bool = false } },
+        { MP_QSTR_ascii, MP_ARG_BOOL, { .u_bool = false } },
+    };
+
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_int_t border = args[ARG_border].u_int;
+    uqr_check_scale(1, border);
+
+    uqr_print_qr(&mp_plat_print, self, border, args[ARG_invert].u_bool, !args[ARG_ascii].u_bool);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(rendered_qr_show_obj, 1, rendered_qr_show);
+
+// rendered_qr_del()
+//
+// Finalializer. Needs to free the rendered QR data.
+//
+    STATIC mp_obj_t
+rendered_qr_del(mp_obj_t self_in) {
+    mp_obj_rendered_qr_t *self = MP_OBJ_TO_PTR(self_in);
+
+    rendered_qr_release(self);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(rendered_qr_del_obj, rendered_qr_del);
+
+#if !MICROPY_ENABLE_DYNRUNTIME
+STATIC const mp_rom_map_elem_t rendered_qr_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&rendered_qr_del_obj) },
+    { MP_ROM_QSTR(MP_QSTR_width), MP_ROM_PTR(&rendered_qr_width_obj) },
+    { MP_ROM_QSTR(MP_QSTR_get), MP_ROM_PTR(&rendered_qr_get_obj) },
+    { MP_ROM_QSTR(MP_QSTR_packed), MP_ROM_PTR(&rendered_qr_packed_obj) },
+    { MP_ROM_QSTR(MP_QSTR_packed_into), MP_ROM_PTR(&rendered_qr_packed_into_obj) },
+    { MP_ROM_QSTR(MP_QSTR_render_into), MP_ROM_PTR(&rendered_qr_render_into_obj) },
+    { MP_ROM_QSTR(MP_QSTR_rows), MP_ROM_PTR(&rendered_qr_rows_obj) },
+    { MP_ROM_QSTR(MP_QSTR_layout), MP_ROM_PTR(&rendered_qr_layout_obj) },
+    { MP_ROM_QSTR(MP_QSTR_show), MP_ROM_PTR(&rendered_qr_show_obj) },
+    { MP_ROM_QSTR(MP_QSTR_version), MP_ROM_PTR(&rendered_qr_version_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(rendered_qr_locals_dict, rendered_qr_locals_dict_table);
+
+#if (MICROPY_VERSION_MAJOR == 1) && (MICROPY_VERSION_MINOR < 20)
+STATIC const mp_obj_type_t mp_type_rendered_qr = {
+    { &mp_type_type },
+    .name = MP_QSTR_RenderedQR,
+    .make_new = rendered_qr_make_new,
+    .print = mp_obj_rendered_qr_print,
+    .buffer_p = { .get_buffer = rendered_qr_get_buffer },
+    .locals_dict = (mp_obj_dict_t *)&rendered_qr_locals_dict,
+};
+#else
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_type_rendered_qr,
+    MP_QSTR_RenderedQR,
+    MP_TYPE_FLAG_NONE,
+    make_new, rendered_qr_make_new,
+    print, mp_obj_rendered_qr_print,
+    buffer, rendered_qr_get_buffer,
+    locals_dict, &rendered_qr_locals_dict
+);
+#endif
+#endif
+
+
+// Our other object: encodes one QR after another with the same options, reusing its
+// work buffers (and optionally the result) so steady-state encoding doesn't allocate.
+typedef struct _mp_obj_encoder_t {
+    mp_obj_base_t base;
+
+    uqr_options_t   opts;
+    uqr_work_t      work;
+} mp_obj_encoder_t;
+
+// encoder_make_new()
+//
+// Constructor: Encoder object. Takes the same keyword options as make().
+//
+    STATIC mp_obj_t
+encoder_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
+{
+    mp_arg_check_num(n_args, n_kw, 0, 0, true);
+    mp_map_t kw_args;
+    mp_map_init_fixed_table(&kw_args, n_kw, all_args + n_args);
+
+    const mp_arg_t allowed_args[] = {
+        UQR_OPTION_ARGS
+    };
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, all_args, &kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_obj_encoder_t *o = m_new_obj(mp_obj_encoder_t);
+    o->base.type = type;
+    uqr_get_options(args, &o->opts);
+
+    // Enough for any QR up to max_version; only optimal encoding of a longer
+    // message (a byte per character) or with more segments grows these.
+    o->work.owned = true;
+    o->work.buf_len = qrcodegen_BUFFER_LEN_FOR_VERSION(o->opts.max_version);
+    o->work.buf = m_new(uint8_t, o->work.buf_len);
+    o->work.max_segs = UQR_STACK_SEGMENTS;
+    o->work.segs = m_new(struct qrcodegen_Segment, o->work.max_segs);
+
+    return MP_OBJ_FROM_PTR(o);
+}
+
+// encoder_encode()
+//
+// Encode a message and return the RenderedQR. With out=, that RenderedQR is
+// overwritten and returned instead. Its buffer is replaced, not drawn over, if too
+// small, if it went out through the buffer protocol (memoryview(out) keeps showing
+// the old QR), or if the message is out itself or a view of it.
+//
+    STATIC mp_obj_t
+encoder_encode(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum {ARG_message, ARG_out};
+    const mp_arg_t allowed_args[] = {
+        { MP_QSTR_message, MP_ARG_OBJ|MP_ARG_REQUIRED, {}},
+        { MP_QSTR_out, MP_ARG_OBJ, { .u_obj = MP_OBJ_NULL } },
+    };
+
+    mp_obj_encoder_t *self = MP_OBJ_TO_PTR(pos_args[0]);
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_obj_rendered_qr_t *out = NULL;
+    mp_obj_t out_in = args[ARG_out].u_obj;
+
+    if(out_in != MP_OBJ_NULL && out_in != mp_const_none) {
+        if(!mp_obj_is_type(out_in, &mp_type_rendered_qr)) {
+            mp_raise_TypeError(MP_ERROR_TEXT("out"));
+        }
+        out = MP_OBJ_TO_PTR(out_in);
+    }
+
+    return MP_OBJ_FROM_PTR(uqr_encode(&self->opts, &self->work, args[ARG_message].u_obj, out));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(encoder_encode_obj, 2, encoder_encode);
+
+#if !MICROPY_ENABLE_DYNRUNTIME
+STATIC const mp_rom_map_elem_t encoder_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_encode), MP_ROM_PTR(&encoder_encode_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(encoder_locals_dict, encoder_locals_dict_table);
+
+#if (MICROPY_VERSION_MAJOR == 1) && (MICROPY_VERSION_MINOR < 20)
+STATIC const mp_obj_type_t mp_type_encoder = {
+    { &mp_type_type },
+    .name = MP_QSTR_Encoder,
+    .make_new = encoder_make_new,
+    .locals_dict = (mp_obj_dict_t *)&encoder_locals_dict,
+};
+#else
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_type_encoder,
+    MP_QSTR_Encoder,
+    MP_TYPE_FLAG_NONE,
+    make_new, encoder_make_new,
+    locals_dict, &encoder_locals_dict
+);
+#endif
+#endif
+
+
+// uqr_make_many()
+//
+// Make a QR for each message of an iterable, with the options parsed once and one set
+// of work buffers for the whole batch. Returns a list of RenderedQR, or with into=
+// writes each QR to that buffer (a byte of width, then the packed() pixels) and
+// returns the list of offsets where each one starts, plus where the last one ends.
+//
+    STATIC mp_obj_t
+uqr_make_many(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    const mp_arg_t allowed_args[] = {
+        { MP_QSTR_messages, MP_ARG_OBJ|MP_ARG_REQUIRED, {}},
+        UQR_OPTION_ARGS,
+        { MP_QSTR_into, MP_ARG_OBJ|MP_ARG_KW_ONLY, { .u_obj = MP_OBJ_NULL } },
+    };
+    const int ARG_into = 1 + UQR_NUM_OPTION_ARGS;
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    uqr_options_t opts;
+    uqr_get_options(&args[1], &opts);
+
+    mp_buffer_info_t into = { 0 };
+    bool packing = (args[ARG_into].u_obj != MP_OBJ_NULL) && (args[ARG_into].u_obj != mp_const_none);
+    if(packing) {
+        mp_get_buffer_raise(args[ARG_into].u_obj, &into, MP_BUFFER_WRITE);
+    }
+
+    // Work buffers for the batch, grown as needed like an Encoder's. If a message
+    // raises, the GC gets them back.
+    uqr_work_t work;
+    work.owned = true;
+    work.buf_len = qrcodegen_BUFFER_LEN_FOR_VERSION(opts.max_version);
+    work.buf = m_new(uint8_t, work.buf_len);
+    work.max_segs = UQR_STACK_SEGMENTS;
+    work.segs = m_new(struct qrcodegen_Segment, work.max_segs);
+
+    mp_obj_t rv = mp_obj_new_list(0, NULL);
+    mp_obj_rendered_qr_t *qr = NULL;        // reused for each QR when packing
+    size_t offset = 0;
+
+    mp_obj_iter_buf_t iter_buf;
+    mp_obj_t iterable = mp_getiter(args[0].u_obj, &iter_buf);
+    mp_obj_t message;
+
+    while((message = mp_iternext(iterable)) != MP_OBJ_STOP_ITERATION) {
+        if(!packing) {
+            mp_obj_list_append(rv, MP_OBJ_FROM_PTR(uqr_encode(&opts, &work, message, NULL)));
+            continue;
+        }
+
+        qr = uqr_encode(&opts, &work, message, qr);
+
+        // rows already in the layout wanted
+        int w = qr->width;
+        size_t len = 1 + UQR_STRIDE(w) * w;
+        if(into.len - offset < len) {
+            mp_raise_ValueError(MP_ERROR_TEXT("into"));
+        }
+
+        uint8_t *dest = (uint8_t *)into.buf + offset;
+        dest[0] = w;
+        memcpy(dest + 1, qr->rendered, len - 1);
+
+        mp_obj_list_append(rv, MP_OBJ_NEW_SMALL_INT(offset));
+        offset += len;
+    }
+
+    if(packing) {
+        mp_obj_list_append(rv, MP_OBJ_NEW_SMALL_INT(offset));
+        if(qr) {
+            rendered_qr_release(qr);        // don't wait for the GC
+        }
+    }
+
+    m_del(uint8_t, work.buf, work.buf_len);
+    m_del(struct qrcodegen_Segment, work.segs, work.max_segs);
+
+    return rv;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(uqr_make_many_obj, 1, uqr_make_many);
+
+#if !MICROPY_ENABLE_DYNRUNTIME
+STATIC const mp_rom_map_elem_t mp_module_uqr_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_uqr) },
+
+    // Constants
+    // error levels
     { MP_ROM_QSTR(MP_QSTR_ECC_LOW), MP_ROM_INT(qrcodegen_Ecc_LOW) },
     { MP_ROM_QSTR(MP_QSTR_ECC_MEDIUM), MP_ROM_INT(qrcodegen_Ecc_MEDIUM) },
     { MP_ROM_QSTR(MP_QSTR_ECC_QUARTILE), MP_ROM_INT(qrcodegen_Ecc_QUARTILE) },
@@ -350,17 +1750,32 @@ STATIC const mp_rom_map_elem_t mp_module_uqr_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_Mode_NUMERIC), MP_ROM_INT(qrcodegen_Mode_NUMERIC) },
     { MP_ROM_QSTR(MP_QSTR_Mode_ALPHANUMERIC), MP_ROM_INT(qrcodegen_Mode_ALPHANUMERIC) },
     { MP_ROM_QSTR(MP_QSTR_Mode_BYTE), MP_ROM_INT(qrcodegen_Mode_BYTE) },
+    { MP_ROM_QSTR(MP_QSTR_Mode_OPTIMAL), MP_ROM_INT(UQR_MODE_OPTIMAL) },
     // kanji and ECI would be hard to use; no encodings other than UTF-8 in mpy?
 
+    // Mask choices, besides forcing one of 0..7
+    { MP_ROM_QSTR(MP_QSTR_Mask_AUTO), MP_ROM_INT(qrcodegen_Mask_AUTO) },
+    { MP_ROM_QSTR(MP_QSTR_Mask_FAST), MP_ROM_INT(qrcodegen_Mask_FAST) },
+
     // Version range
     { MP_ROM_QSTR(MP_QSTR_VERSION_MIN), MP_ROM_INT(qrcodegen_VERSION_MIN) },
     { MP_ROM_QSTR(MP_QSTR_VERSION_MAX), MP_ROM_INT(qrcodegen_VERSION_MAX) },
 
+    // RAM used by per-version caches (set by QRCODEGEN_CACHE_VERSION_MAX at build time)
+    { MP_ROM_QSTR(MP_QSTR_CACHE_BYTES), MP_ROM_INT(qrcodegen_CACHE_LEN) },
+
+    // Pixel formats for render_into(), same values as in framebuf
+    { MP_ROM_QSTR(MP_QSTR_MONO_VLSB), MP_ROM_INT(UQR_MONO_VLSB) },
+    { MP_ROM_QSTR(MP_QSTR_MONO_HLSB), MP_ROM_INT(UQR_MONO_HLSB) },
+    { MP_ROM_QSTR(MP_QSTR_MONO_HMSB), MP_ROM_INT(UQR_MONO_HMSB) },
+    { MP_ROM_QSTR(MP_QSTR_GS2_HMSB), MP_ROM_INT(UQR_GS2_HMSB) },
+    { MP_ROM_QSTR(MP_QSTR_GS4_HMSB), MP_ROM_INT(UQR_GS4_HMSB) },
+    { MP_ROM_QSTR(MP_QSTR_RGB565), MP_ROM_INT(UQR_RGB565) },
+
     // Functions 
     { MP_ROM_QSTR(MP_QSTR_make), MP_ROM_PTR(&mp_type_rendered_qr) },
-
-    // API limitation: can't create QR's with various segments of different types. For optimium
-    // compression you need that; so some parts are alnum, and others byte and so on.
+    { MP_ROM_QSTR(MP_QSTR_Encoder), MP_ROM_PTR(&mp_type_encoder) },
+    { MP_ROM_QSTR(MP_QSTR_make_many), MP_ROM_PTR(&uqr_make_many_obj) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_uqr_globals, mp_module_uqr_globals_table);
@@ -412,6 +1827,7 @@ mpy_init(mp_obj_fun_bc_t *self, size_t n_args, size_t n_kw, mp_obj_t *args)
     mp_store_global(MP_QSTR_Mode_NUMERIC, MP_ROM_INT(qrcodegen_Mode_NUMERIC));
     mp_store_global(MP_QSTR_Mode_ALPHANUMERIC, MP_ROM_INT(qrcodegen_Mode_ALPHANUMERIC));
     mp_store_global(MP_QSTR_Mode_BYTE, MP_ROM_INT(qrcodegen_Mode_BYTE));
+    mp_store_global(MP_QSTR_Mode_OPTIMAL, MP_ROM_INT(UQR_MODE_OPTIMAL));
 
     // Version range
     mp_store_global(MP_QSTR_VERSION_MIN, MP_ROM_INT(qrcodegen_VERSION_MIN));
@@ -419,6 +1835,8 @@ mpy_init(mp_obj_fun_bc_t *self, size_t n_args, size_t n_kw, mp_obj_t *args)
 
     // Functions 
     mp_store_global(MP_QSTR_make, MP_OBJ_FROM_PTR(&mp_type_rendered_qr));
+    mp_store_global(MP_QSTR_Encoder, MP_OBJ_FROM_PTR(&mp_type_encoder));
+    mp_store_global(MP_QSTR_make_many, MP_OBJ_FROM_PTR(&uqr_make_many_obj));
 
     // This must be last, it restores the globals dict
     MP_DYNRUNTIME_INIT_EXIT
@@ -451,12 +1869,13 @@ size_t   strlen(const char *s) {
 #endif
 
 // Library uses asserts for out-of-range inputs, so convert those
-// into exceptions which can be handled
+// into exceptions which can be handled. Characters that don't suit a forced
+// encoding are caught before that, so the error can say where they are:
 //
-//      >>> uqr.make("abc", encoding=uqr.Mode_NUMERIC)
+//      >>> uqr.make("12a", encoding=uqr.Mode_NUMERIC)
 //      Traceback (most recent call last):
 //        File "<stdin>", line 1, in <module>
-//      RuntimeError: 906
+//      ValueError: can't encode character at offset 2
 //
 #undef assert
 #define assert(e)      ((void) ((e) ? ((void)0) : _uqr_assert (__LINE__)))
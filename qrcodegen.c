@@ -34,55 +34,131 @@
 	#define testable  // Expose private functions
 #endif
 
+// Reed-Solomon arithmetic is table-driven by default, at a cost of about 1 KiB of
+// constant data. Build with QRCODEGEN_RS_TABLES defined as 0 on small-flash targets
+// to compute field products and generator polynomials at runtime instead.
+#ifndef QRCODEGEN_RS_TABLES
+	#define QRCODEGEN_RS_TABLES 1
+#endif
+
+// Automatic mask selection can build and score the eight candidates on up to this many
+// threads, using POSIX threads. It stays serial if this is 1 (the default), where POSIX
+// threads aren't available, or when the system has only one CPU online.
+#ifndef QRCODEGEN_MASK_THREADS
+	#define QRCODEGEN_MASK_THREADS 1
+#endif
+#if QRCODEGEN_MASK_THREADS > 1 && !(defined(__unix__) || defined(__APPLE__))
+	#undef QRCODEGEN_MASK_THREADS
+	#define QRCODEGEN_MASK_THREADS 1
+#endif
+#if QRCODEGEN_MASK_THREADS > 1
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
 
 /*---- Forward declarations for private functions ----*/
 
+#if !QRCODEGEN_RS_TABLES
+// A word of independent byte lanes, for computing the ECC of several blocks at once.
+#if UINTPTR_MAX > 0xFFFFFFFFu
+	typedef uint64_t rs_lanes_t;
+#else
+	typedef uint32_t rs_lanes_t;
+#endif
+#endif
+
 // Regarding all public and private functions defined in this source file:
 // - They require all pointer/array arguments to be not null unless the array length is zero.
 // - They only read input scalar/array arguments, write to output pointer/array
 //   arguments, and return scalar values; they are "pure" functions.
-// - They don't read mutable global variables or write to any global variables.
+// - They don't read mutable global variables or write to any global variables, except for
+//   the per-version caches, which are filled in the first time a version is used.
 // - They don't perform I/O, read the clock, print to console, etc.
 // - They allocate a small and constant amount of stack memory.
-// - They don't allocate or free any memory on the heap.
+// - They don't allocate or free any memory on the heap, or start threads, except for
+//   threaded mask selection when built with QRCODEGEN_MASK_THREADS.
 // - They don't recurse or mutually recurse. All the code
 //   could be inlined into the top-level public functions.
 // - They run in at most quadratic time with respect to input arguments.
 //   Most functions run in linear time, and some in constant time.
 //   There are no unbounded loops or non-obvious termination conditions.
 // - They are completely thread-safe if the caller does not give the
-//   same writable buffer to concurrent calls to these functions.
+//   same writable buffer to concurrent calls to these functions, and
+//   the first use of each cached version is not concurrent.
+
+// Appends bits to a byte-based bit buffer in bitwise big endian, a byte at a time. The pending bits
+// are kept in a 32-bit accumulator, aligned to its most significant end, and whole bytes are stored
+// as soon as they are complete. All fields are private, except that bitLen may be read at any time.
+struct BitWriter {
+	uint8_t *buffer;
+	int bitLen;  // Total number of bits appended, including the pending ones
+	uint32_t accum;
+	int accumBits;  // Number of pending bits, in the range [0, 7] between calls
+};
 
 testable void appendBitsToBuffer(unsigned int val, int numBits, uint8_t buffer[], int *bitLen);
+static void bitWriterInit(struct BitWriter *bw, uint8_t buffer[], int bitLen);
+static void bitWriterAppend(struct BitWriter *bw, unsigned long val, int numBits);
+static void bitWriterAppendBits(struct BitWriter *bw, const uint8_t data[], int numBits);
+static void bitWriterFinish(struct BitWriter *bw);
 
-testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]);
+testable void addEccAndInterleave(const uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]);
 testable int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl);
 testable int getNumRawDataModules(int ver);
 
 testable void reedSolomonComputeDivisor(int degree, uint8_t result[]);
-testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
-	const uint8_t generator[], int degree, uint8_t result[]);
+static const uint8_t *reedSolomonGetDivisor(int degree, uint8_t buf[]);
+testable void reedSolomonComputeRemainders(const uint8_t data[], int numBlocks, int numShortBlocks,
+	int shortBlockDataLen, const uint8_t generator[], int degree, uint8_t result[]);
+#if !QRCODEGEN_RS_TABLES
+static rs_lanes_t reedSolomonLoadLanes(const uint8_t src[], int n);
+static void reedSolomonStoreLanes(uint8_t dest[], rs_lanes_t lanes, int n);
+static rs_lanes_t reedSolomonMultiplyLanesByTwo(rs_lanes_t x);
+#endif
 testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y);
 
 testable void initializeFunctionModules(int version, uint8_t qrcode[]);
 static void drawLightFunctionModules(uint8_t qrcode[], int version);
+static const uint8_t *getFunctionTemplate(int version);
+static void drawFunctionTemplate(const uint8_t functionTemplate[], uint8_t qrcode[]);
+static const uint16_t *getPlacementMap(int version);
+#if !defined(QRCODEGEN_GENERATED_TABLES) && QRCODEGEN_CACHE_VERSION_MAX > 0
+testable int buildPlacementMap(const uint8_t functionModules[], uint16_t result[]);
+#endif
 static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]);
 testable int getAlignmentPatternPositions(int version, uint8_t result[7]);
 static void fillRectangle(int left, int top, int width, int height, uint8_t qrcode[]);
 
 static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]);
+static void drawCodewordsMapped(const uint16_t placementMap[], const uint8_t data[], int dataLen, uint8_t qrcode[]);
 static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
-static long getPenaltyScore(const uint8_t qrcode[]);
+static void applyMasks(const uint8_t functionModules[], const uint8_t qrcode[], int firstMask, int count,
+	uint8_t result[], size_t bufLen);
+#if QRCODEGEN_MASK_THREADS > 1
+static enum qrcodegen_Mask chooseMaskThreaded(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Ecc ecl);
+static void *scoreMaskCandidates(void *arg);
+#endif
+static long getPenaltyScore(const uint8_t qrcode[], long limit);
+static long getRowPenaltyScore(const uint8_t qrcode[], long limit);
+static long getLinePenaltyScore(const uint32_t line[], int qrsize);
+static void transposeModuleBlock(uint32_t block[32]);
 static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize);
 static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int runHistory[7], int qrsize);
 static void finderPenaltyAddHistory(int currentRunLength, int runHistory[7], int qrsize);
 
 testable bool getModuleBounded(const uint8_t qrcode[], int x, int y);
+static uint32_t getModuleWord(const uint8_t qrcode[], int index, int count);
 testable void setModuleBounded(uint8_t qrcode[], int x, int y, bool isDark);
 testable void setModuleUnbounded(uint8_t qrcode[], int x, int y, bool isDark);
 static bool getBit(int x, int i);
+static int countTrailingZeros(uint32_t x);
+static int countOnes(uint32_t x);
 
 // int calcSegmentBitLength(enum qrcodegen_Mode mode, size_t numChars);
+static bool isDigitWord(uint32_t word);
+static struct qrcodegen_Segment makeSegment(enum qrcodegen_Mode mode, const char text[], size_t len, uint8_t buf[]);
+static void appendChars(struct BitWriter *bw, enum qrcodegen_Mode mode, const char text[], size_t len);
 testable int getTotalBits(const struct qrcodegen_Segment segs[], size_t len, int version);
 static int numCharCountBits(enum qrcodegen_Mode mode, int version);
 
@@ -90,9 +166,28 @@ static int numCharCountBits(enum qrcodegen_Mode mode, int version);
 
 /*---- Private tables of constants ----*/
 
-// The set of all legal characters in alphanumeric mode, where each character
-// value maps to the index in the string. For checking text and encoding segments.
-static const char *ALPHANUMERIC_CHARSET = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+// Maps each byte to its value in alphanumeric mode, or NOT_ALPHANUMERIC if it is not one
+// of the 45 legal characters "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:". The digits
+// have values 0 to 9, so the same lookup also tells whether a byte is legal in numeric mode.
+#define NOT_ALPHANUMERIC 255
+static const uint8_t ALPHANUMERIC_VALUES[256] = {
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	 36, 255, 255, 255,  37,  38, 255, 255, 255, 255,  39,  40, 255,  41,  42,  43,
+	  0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  44, 255, 255, 255, 255, 255,
+	255,  10,  11,  12,  13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,
+	 25,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
 
 // Sentinel value for use in only some functions.
 #define LENGTH_OVERFLOW -1
@@ -119,12 +214,165 @@ testable const int8_t NUM_ERROR_CORRECTION_BLOCKS[4][41] = {
 	{-1, 1, 1, 2, 4, 4, 4, 5, 6, 8, 8, 11, 11, 16, 16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},  // High
 };
 
+#define qrcodegen_ECC_BLOCKS_MAX 81  // Based on the table above
+
+#if QRCODEGEN_RS_TABLES
+// Powers of the generator element 0x02 in GF(2^8/0x11D). The 255-entry cycle is
+// stored twice so that the sum of two logarithms can be used as an index directly.
+static const uint8_t REED_SOLOMON_EXP[510] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1D, 0x3A, 0x74, 0xE8, 0xCD, 0x87, 0x13, 0x26,
+	0x4C, 0x98, 0x2D, 0x5A, 0xB4, 0x75, 0xEA, 0xC9, 0x8F, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0,
+	0x9D, 0x27, 0x4E, 0x9C, 0x25, 0x4A, 0x94, 0x35, 0x6A, 0xD4, 0xB5, 0x77, 0xEE, 0xC1, 0x9F, 0x23,
+	0x46, 0x8C, 0x05, 0x0A, 0x14, 0x28, 0x50, 0xA0, 0x5D, 0xBA, 0x69, 0xD2, 0xB9, 0x6F, 0xDE, 0xA1,
+	0x5F, 0xBE, 0x61, 0xC2, 0x99, 0x2F, 0x5E, 0xBC, 0x65, 0xCA, 0x89, 0x0F, 0x1E, 0x3C, 0x78, 0xF0,
+	0xFD, 0xE7, 0xD3, 0xBB, 0x6B, 0xD6, 0xB1, 0x7F, 0xFE, 0xE1, 0xDF, 0xA3, 0x5B, 0xB6, 0x71, 0xE2,
+	0xD9, 0xAF, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0D, 0x1A, 0x34, 0x68, 0xD0, 0xBD, 0x67, 0xCE,
+	0x81, 0x1F, 0x3E, 0x7C, 0xF8, 0xED, 0xC7, 0x93, 0x3B, 0x76, 0xEC, 0xC5, 0x97, 0x33, 0x66, 0xCC,
+	0x85, 0x17, 0x2E, 0x5C, 0xB8, 0x6D, 0xDA, 0xA9, 0x4F, 0x9E, 0x21, 0x42, 0x84, 0x15, 0x2A, 0x54,
+	0xA8, 0x4D, 0x9A, 0x29, 0x52, 0xA4, 0x55, 0xAA, 0x49, 0x92, 0x39, 0x72, 0xE4, 0xD5, 0xB7, 0x73,
+	0xE6, 0xD1, 0xBF, 0x63, 0xC6, 0x91, 0x3F, 0x7E, 0xFC, 0xE5, 0xD7, 0xB3, 0x7B, 0xF6, 0xF1, 0xFF,
+	0xE3, 0xDB, 0xAB, 0x4B, 0x96, 0x31, 0x62, 0xC4, 0x95, 0x37, 0x6E, 0xDC, 0xA5, 0x57, 0xAE, 0x41,
+	0x82, 0x19, 0x32, 0x64, 0xC8, 0x8D, 0x07, 0x0E, 0x1C, 0x38, 0x70, 0xE0, 0xDD, 0xA7, 0x53, 0xA6,
+	0x51, 0xA2, 0x59, 0xB2, 0x79, 0xF2, 0xF9, 0xEF, 0xC3, 0x9B, 0x2B, 0x56, 0xAC, 0x45, 0x8A, 0x09,
+	0x12, 0x24, 0x48, 0x90, 0x3D, 0x7A, 0xF4, 0xF5, 0xF7, 0xF3, 0xFB, 0xEB, 0xCB, 0x8B, 0x0B, 0x16,
+	0x2C, 0x58, 0xB0, 0x7D, 0xFA, 0xE9, 0xCF, 0x83, 0x1B, 0x36, 0x6C, 0xD8, 0xAD, 0x47, 0x8E, 0x01,
+	0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1D, 0x3A, 0x74, 0xE8, 0xCD, 0x87, 0x13, 0x26, 0x4C,
+	0x98, 0x2D, 0x5A, 0xB4, 0x75, 0xEA, 0xC9, 0x8F, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0, 0x9D,
+	0x27, 0x4E, 0x9C, 0x25, 0x4A, 0x94, 0x35, 0x6A, 0xD4, 0xB5, 0x77, 0xEE, 0xC1, 0x9F, 0x23, 0x46,
+	0x8C, 0x05, 0x0A, 0x14, 0x28, 0x50, 0xA0, 0x5D, 0xBA, 0x69, 0xD2, 0xB9, 0x6F, 0xDE, 0xA1, 0x5F,
+	0xBE, 0x61, 0xC2, 0x99, 0x2F, 0x5E, 0xBC, 0x65, 0xCA, 0x89, 0x0F, 0x1E, 0x3C, 0x78, 0xF0, 0xFD,
+	0xE7, 0xD3, 0xBB, 0x6B, 0xD6, 0xB1, 0x7F, 0xFE, 0xE1, 0xDF, 0xA3, 0x5B, 0xB6, 0x71, 0xE2, 0xD9,
+	0xAF, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0D, 0x1A, 0x34, 0x68, 0xD0, 0xBD, 0x67, 0xCE, 0x81,
+	0x1F, 0x3E, 0x7C, 0xF8, 0xED, 0xC7, 0x93, 0x3B, 0x76, 0xEC, 0xC5, 0x97, 0x33, 0x66, 0xCC, 0x85,
+	0x17, 0x2E, 0x5C, 0xB8, 0x6D, 0xDA, 0xA9, 0x4F, 0x9E, 0x21, 0x42, 0x84, 0x15, 0x2A, 0x54, 0xA8,
+	0x4D, 0x9A, 0x29, 0x52, 0xA4, 0x55, 0xAA, 0x49, 0x92, 0x39, 0x72, 0xE4, 0xD5, 0xB7, 0x73, 0xE6,
+	0xD1, 0xBF, 0x63, 0xC6, 0x91, 0x3F, 0x7E, 0xFC, 0xE5, 0xD7, 0xB3, 0x7B, 0xF6, 0xF1, 0xFF, 0xE3,
+	0xDB, 0xAB, 0x4B, 0x96, 0x31, 0x62, 0xC4, 0x95, 0x37, 0x6E, 0xDC, 0xA5, 0x57, 0xAE, 0x41, 0x82,
+	0x19, 0x32, 0x64, 0xC8, 0x8D, 0x07, 0x0E, 0x1C, 0x38, 0x70, 0xE0, 0xDD, 0xA7, 0x53, 0xA6, 0x51,
+	0xA2, 0x59, 0xB2, 0x79, 0xF2, 0xF9, 0xEF, 0xC3, 0x9B, 0x2B, 0x56, 0xAC, 0x45, 0x8A, 0x09, 0x12,
+	0x24, 0x48, 0x90, 0x3D, 0x7A, 0xF4, 0xF5, 0xF7, 0xF3, 0xFB, 0xEB, 0xCB, 0x8B, 0x0B, 0x16, 0x2C,
+	0x58, 0xB0, 0x7D, 0xFA, 0xE9, 0xCF, 0x83, 0x1B, 0x36, 0x6C, 0xD8, 0xAD, 0x47, 0x8E,
+};
+
+// Discrete logarithms base 0x02 in GF(2^8/0x11D), the inverse of REED_SOLOMON_EXP.
+// Index 0 is for padding, because zero has no logarithm.
+static const uint8_t REED_SOLOMON_LOG[256] = {
+	0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1A, 0xC6, 0x03, 0xDF, 0x33, 0xEE, 0x1B, 0x68, 0xC7, 0x4B,
+	0x04, 0x64, 0xE0, 0x0E, 0x34, 0x8D, 0xEF, 0x81, 0x1C, 0xC1, 0x69, 0xF8, 0xC8, 0x08, 0x4C, 0x71,
+	0x05, 0x8A, 0x65, 0x2F, 0xE1, 0x24, 0x0F, 0x21, 0x35, 0x93, 0x8E, 0xDA, 0xF0, 0x12, 0x82, 0x45,
+	0x1D, 0xB5, 0xC2, 0x7D, 0x6A, 0x27, 0xF9, 0xB9, 0xC9, 0x9A, 0x09, 0x78, 0x4D, 0xE4, 0x72, 0xA6,
+	0x06, 0xBF, 0x8B, 0x62, 0x66, 0xDD, 0x30, 0xFD, 0xE2, 0x98, 0x25, 0xB3, 0x10, 0x91, 0x22, 0x88,
+	0x36, 0xD0, 0x94, 0xCE, 0x8F, 0x96, 0xDB, 0xBD, 0xF1, 0xD2, 0x13, 0x5C, 0x83, 0x38, 0x46, 0x40,
+	0x1E, 0x42, 0xB6, 0xA3, 0xC3, 0x48, 0x7E, 0x6E, 0x6B, 0x3A, 0x28, 0x54, 0xFA, 0x85, 0xBA, 0x3D,
+	0xCA, 0x5E, 0x9B, 0x9F, 0x0A, 0x15, 0x79, 0x2B, 0x4E, 0xD4, 0xE5, 0xAC, 0x73, 0xF3, 0xA7, 0x57,
+	0x07, 0x70, 0xC0, 0xF7, 0x8C, 0x80, 0x63, 0x0D, 0x67, 0x4A, 0xDE, 0xED, 0x31, 0xC5, 0xFE, 0x18,
+	0xE3, 0xA5, 0x99, 0x77, 0x26, 0xB8, 0xB4, 0x7C, 0x11, 0x44, 0x92, 0xD9, 0x23, 0x20, 0x89, 0x2E,
+	0x37, 0x3F, 0xD1, 0x5B, 0x95, 0xBC, 0xCF, 0xCD, 0x90, 0x87, 0x97, 0xB2, 0xDC, 0xFC, 0xBE, 0x61,
+	0xF2, 0x56, 0xD3, 0xAB, 0x14, 0x2A, 0x5D, 0x9E, 0x84, 0x3C, 0x39, 0x53, 0x47, 0x6D, 0x41, 0xA2,
+	0x1F, 0x2D, 0x43, 0xD8, 0xB7, 0x7B, 0xA4, 0x76, 0xC4, 0x17, 0x49, 0xEC, 0x7F, 0x0C, 0x6F, 0xF6,
+	0x6C, 0xA1, 0x3B, 0x52, 0x29, 0x9D, 0x55, 0xAA, 0xFB, 0x60, 0x86, 0xB1, 0xBB, 0xCC, 0x3E, 0x5A,
+	0xCB, 0x59, 0x5F, 0xB0, 0x9C, 0xA9, 0xA0, 0x51, 0x0B, 0xF5, 0x16, 0xEB, 0x7A, 0x75, 0x2C, 0xD7,
+	0x4F, 0xAE, 0xD5, 0xE9, 0xE6, 0xE7, 0xAD, 0xE8, 0x74, 0xD6, 0xF4, 0xEA, 0xA8, 0x50, 0x58, 0xAF,
+};
+
+// The Reed-Solomon generator polynomials for every degree that appears in ECC_CODEWORDS_PER_BLOCK,
+// concatenated, in the same form as reedSolomonComputeDivisor() produces. None of the coefficients are zero.
+static const uint8_t REED_SOLOMON_GENERATORS[246] = {
+	// Degree 7
+	0x7F, 0x7A, 0x9A, 0xA4, 0x0B, 0x44, 0x75,
+	// Degree 10
+	0xD8, 0xC2, 0x9F, 0x6F, 0xC7, 0x5E, 0x5F, 0x71, 0x9D, 0xC1,
+	// Degree 13
+	0x89, 0x49, 0xE3, 0x11, 0xB1, 0x11, 0x34, 0x0D, 0x2E, 0x2B, 0x53, 0x84, 0x78,
+	// Degree 15
+	0x1D, 0xC4, 0x6F, 0xA3, 0x70, 0x4A, 0x0A, 0x69, 0x69, 0x8B, 0x84, 0x97, 0x20, 0x86, 0x1A,
+	// Degree 16
+	0x3B, 0x0D, 0x68, 0xBD, 0x44, 0xD1, 0x1E, 0x08, 0xA3, 0x41, 0x29, 0xE5, 0x62, 0x32, 0x24, 0x3B,
+	// Degree 17
+	0x77, 0x42, 0x53, 0x78, 0x77, 0x16, 0xC5, 0x53, 0xF9, 0x29, 0x8F, 0x86, 0x55, 0x35, 0x7D, 0x63, 0x4F,
+	// Degree 18
+	0xEF, 0xFB, 0xB7, 0x71, 0x95, 0xAF, 0xC7, 0xD7, 0xF0, 0xDC, 0x49, 0x52, 0xAD, 0x4B, 0x20, 0x43, 0xD9, 0x92,
+	// Degree 20
+	0x98, 0xB9, 0xF0, 0x05, 0x6F, 0x63, 0x06, 0xDC, 0x70, 0x96, 0x45, 0x24, 0xBB, 0x16, 0xE4, 0xC6, 0x79, 0x79, 0xA5, 0xAE,
+	// Degree 22
+	0x59, 0xB3, 0x83, 0xB0, 0xB6, 0xF4, 0x13, 0xBD, 0x45, 0x28, 0x1C, 0x89, 0x1D, 0x7B, 0x43, 0xFD, 0x56, 0xDA, 0xE6, 0x1A, 0x91, 0xF5,
+	// Degree 24
+	0x7A, 0x76, 0xA9, 0x46, 0xB2, 0xED, 0xD8, 0x66, 0x73, 0x96, 0xE5, 0x49, 0x82, 0x48, 0x3D, 0x2B, 0xCE, 0x01, 0xED, 0xF7, 0x7F, 0xD9, 0x90, 0x75,
+	// Degree 26
+	0xF6, 0x33, 0xB7, 0x04, 0x88, 0x62, 0xC7, 0x98, 0x4D, 0x38, 0xCE, 0x18, 0x91, 0x28, 0xD1, 0x75, 0xE9, 0x2A, 0x87, 0x44, 0x46, 0x90, 0x92, 0x4D, 0x2B, 0x5E,
+	// Degree 28
+	0xFC, 0x09, 0x1C, 0x0D, 0x12, 0xFB, 0xD0, 0x96, 0x67, 0xAE, 0x64, 0x29, 0xA7, 0x0C, 0xF7, 0x38, 0x75, 0x77, 0xE9, 0x7F, 0xB5, 0x64, 0x79, 0x93, 0xB0, 0x4A, 0x3A, 0xC5,
+	// Degree 30
+	0xD4, 0xF6, 0x4D, 0x49, 0xC3, 0xC0, 0x4B, 0x62, 0x05, 0x46, 0x67, 0xB1, 0x16, 0xD9, 0x8A, 0x33, 0xB5, 0xF6, 0x48, 0x19, 0x12, 0x2E, 0xE4, 0x4A, 0xD8, 0xC3, 0x0B, 0x6A, 0x82, 0x96,
+};
+
+// Offset of each degree's polynomial in REED_SOLOMON_GENERATORS, or -1 for a degree that is never used.
+static const int16_t REED_SOLOMON_GENERATOR_OFFSET[31] = {
+	-1, -1, -1, -1, -1, -1, -1,   0, -1, -1,   7, -1, -1,  17, -1,  30,
+	45,  61,  78, -1,  96, -1, 116, -1, 138, -1, 162, -1, 188, -1, 216,
+};
+#endif
+
+#if QRCODEGEN_CACHE_VERSION_MAX > 0
+// The function module templates of versions 1 to QRCODEGEN_CACHE_VERSION_MAX, in ascending order of
+// version. Each is built on first use by getFunctionTemplate(), and is all zeros until then.
+static uint8_t functionTemplateCache[qrcodegen_SUM_CACHED_(qrcodegen_TEMPLATE_LEN_)];
+#endif
+
+#if defined(QRCODEGEN_GENERATED_TABLES)
+// Generated by gen_tables.py: const per-version geometry, format and version bits,
+// and the placement maps of versions 1 to QRCODEGEN_TABLES_VERSION_MAX
+#include "qrcodegen_tables.h"
+#if QRCODEGEN_TABLES_VERSION_MAX < QRCODEGEN_CACHE_VERSION_MAX
+	#error "qrcodegen_tables.h must cover all cached versions; rerun gen_tables.py with a larger version"
+#endif
+#elif QRCODEGEN_CACHE_VERSION_MAX > 0
+// The placement maps of versions 1 to QRCODEGEN_CACHE_VERSION_MAX, laid out
+// like the templates above. Each is built on first use by getPlacementMap().
+static uint16_t placementMapCache[qrcodegen_SUM_CACHED_(qrcodegen_PLACEMENT_MAP_LEN_)];
+#endif
+
+// For applying masks. Every mask pattern repeats every 6 columns and 12 rows, so entry
+// [mask][y % 12] holds the pattern of columns 0 to 23 of row y, with column x at bit x.
+static const uint32_t MASK_ROW_PATTERNS[8][12] = {
+	{0x555555, 0xAAAAAA, 0x555555, 0xAAAAAA, 0x555555, 0xAAAAAA, 0x555555, 0xAAAAAA, 0x555555, 0xAAAAAA, 0x555555, 0xAAAAAA},  // (x + y) % 2 == 0
+	{0xFFFFFF, 0x000000, 0xFFFFFF, 0x000000, 0xFFFFFF, 0x000000, 0xFFFFFF, 0x000000, 0xFFFFFF, 0x000000, 0xFFFFFF, 0x000000},  // y % 2 == 0
+	{0x249249, 0x249249, 0x249249, 0x249249, 0x249249, 0x249249, 0x249249, 0x249249, 0x249249, 0x249249, 0x249249, 0x249249},  // x % 3 == 0
+	{0x249249, 0x924924, 0x492492, 0x249249, 0x924924, 0x492492, 0x249249, 0x924924, 0x492492, 0x249249, 0x924924, 0x492492},  // (x + y) % 3 == 0
+	{0x1C71C7, 0x1C71C7, 0xE38E38, 0xE38E38, 0x1C71C7, 0x1C71C7, 0xE38E38, 0xE38E38, 0x1C71C7, 0x1C71C7, 0xE38E38, 0xE38E38},  // (x / 3 + y / 2) % 2 == 0
+	{0xFFFFFF, 0x041041, 0x249249, 0x555555, 0x249249, 0x041041, 0xFFFFFF, 0x041041, 0x249249, 0x555555, 0x249249, 0x041041},  // x * y % 2 + x * y % 3 == 0
+	{0xFFFFFF, 0x1C71C7, 0x6DB6DB, 0x555555, 0xB6DB6D, 0xC71C71, 0xFFFFFF, 0x1C71C7, 0x6DB6DB, 0x555555, 0xB6DB6D, 0xC71C71},  // (x * y % 2 + x * y % 3) % 2 == 0
+	{0x555555, 0xE38E38, 0xC71C71, 0xAAAAAA, 0x1C71C7, 0x38E38E, 0x555555, 0xE38E38, 0xC71C71, 0xAAAAAA, 0x1C71C7, 0x38E38E},  // ((x + y) % 2 + x * y % 3) % 2 == 0
+};
+
 // For automatic mask pattern selection.
+#if QRCODEGEN_MASK_THREADS > 1
+static const int MASK_THREADS_MIN_VERSION = 5;  // Smaller QR Codes are quicker to do serially
+
+// The state shared by the threads of chooseMaskThreaded().
+struct MaskSearch {
+	const uint8_t *functionModules;
+	const uint8_t *qrcode;  // Unmasked
+	uint8_t *candidates;  // Eight buffers of bufLen bytes each
+	size_t bufLen;
+	enum qrcodegen_Ecc ecl;
+	pthread_mutex_t lock;
+	int nextMask;  // Guarded by lock
+	long penalties[8];
+};
+#endif
 static const int PENALTY_N1 =  3;
 static const int PENALTY_N2 =  3;
 static const int PENALTY_N3 = 40;
 static const int PENALTY_N4 = 10;
 
+// The number of 32-bit words in a row or column of the largest QR Code, for penalty scoring.
+#define PENALTY_LINE_WORDS  ((qrcodegen_VERSION_MAX * 4 + 17 + 31) / 32)
+
+// The number of columns transposed and scored together by getPenaltyScore(), at most 32. Each block
+// is transposed once per strip, so narrower strips cost time; 8 costs little and keeps the frame small.
+#define PENALTY_STRIP_COLUMNS  8
+
 
 
 /*---- High-level QR Code encoding functions ----*/
@@ -134,36 +382,28 @@ bool qrcodegen_encodeText(const char *text, uint8_t tempBuffer[], uint8_t qrcode
 		enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl) {
 	
 	size_t textLen = strlen(text);
-	if (textLen == 0)
-		return qrcodegen_encodeSegmentsAdvanced(NULL, 0, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
-	size_t bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion);
+	enum qrcodegen_Mode mode = qrcodegen_classifyText(text, textLen, NULL, NULL);
+	return qrcodegen_encodeChars(text, textLen, mode, tempBuffer, qrcode, ecl, minVersion, maxVersion, mask, boostEcl);
+}
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_encodeChars(const char text[], size_t textLen, enum qrcodegen_Mode mode, uint8_t tempBuffer[],
+		uint8_t qrcode[], enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl) {
 	
+	assert(text != NULL || textLen == 0);
+	assert(mode == qrcodegen_Mode_NUMERIC || mode == qrcodegen_Mode_ALPHANUMERIC || mode == qrcodegen_Mode_BYTE);
 	struct qrcodegen_Segment seg;
-	if (qrcodegen_isNumeric(text)) {
-		if (qrcodegen_calcSegmentBufferSize(qrcodegen_Mode_NUMERIC, textLen) > bufLen)
-			goto fail;
-		seg = qrcodegen_makeNumeric(text, tempBuffer);
-	} else if (qrcodegen_isAlphanumeric(text)) {
-		if (qrcodegen_calcSegmentBufferSize(qrcodegen_Mode_ALPHANUMERIC, textLen) > bufLen)
-			goto fail;
-		seg = qrcodegen_makeAlphanumeric(text, tempBuffer);
-	} else {
-		if (textLen > bufLen)
-			goto fail;
-		for (size_t i = 0; i < textLen; i++)
-			tempBuffer[i] = (uint8_t)text[i];
-		seg.mode = qrcodegen_Mode_BYTE;
-		seg.bitLength = calcSegmentBitLength(seg.mode, textLen);
-		if (seg.bitLength == LENGTH_OVERFLOW)
-			goto fail;
-		seg.numChars = (int)textLen;
-		seg.data = tempBuffer;
+	seg.mode = mode;
+	seg.bitLength = calcSegmentBitLength(seg.mode, textLen);
+	if (seg.bitLength == LENGTH_OVERFLOW) {
+		qrcode[0] = 0;  // Set size to invalid value for safety
+		return false;
 	}
-	return qrcodegen_encodeSegmentsAdvanced(&seg, 1, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
-	
-fail:
-	qrcode[0] = 0;  // Set size to invalid value for safety
-	return false;
+	seg.numChars = (int)textLen;
+	seg.data = NULL;  // The characters are packed from the text instead
+	return qrcodegen_encodeSegmentsText(&seg, textLen > 0 ? 1 : 0, text, ecl, minVersion, maxVersion, mask, boostEcl,
+		tempBuffer, qrcode, NULL, 0);
 }
 
 
@@ -188,8 +428,64 @@ bool qrcodegen_encodeBinary(uint8_t dataAndTemp[], size_t dataLen, uint8_t qrcod
 // bit buffer, increasing the bit length. Requires 0 <= numBits <= 16 and val < 2^numBits.
 testable void appendBitsToBuffer(unsigned int val, int numBits, uint8_t buffer[], int *bitLen) {
 	assert(0 <= numBits && numBits <= 16 && (unsigned long)val >> numBits == 0);
-	for (int i = numBits - 1; i >= 0; i--, (*bitLen)++)
-		buffer[*bitLen >> 3] |= ((val >> i) & 1) << (7 - (*bitLen & 7));
+	struct BitWriter bw;
+	bitWriterInit(&bw, buffer, *bitLen);
+	bitWriterAppend(&bw, val, numBits);
+	bitWriterFinish(&bw);
+	*bitLen = bw.bitLen;
+}
+
+
+// Starts appending to the given bit buffer, which already holds bitLen bits. The unused
+// low-order bits of a partial last byte are ignored and will be overwritten.
+static void bitWriterInit(struct BitWriter *bw, uint8_t buffer[], int bitLen) {
+	assert(bitLen >= 0);
+	bw->buffer = buffer;
+	bw->bitLen = bitLen;
+	bw->accumBits = bitLen & 7;
+	bw->accum = (bw->accumBits > 0) ? (uint32_t)(buffer[bitLen >> 3] & (0xFF00 >> bw->accumBits)) << 24 : 0;
+}
+
+
+// Appends the given number of low-order bits of the given value. Requires 0 <= numBits <= 24 and val < 2^numBits.
+static void bitWriterAppend(struct BitWriter *bw, unsigned long val, int numBits) {
+	assert(0 <= numBits && numBits <= 24 && val >> numBits == 0);
+	if (numBits == 0)
+		return;
+	bw->accum |= (uint32_t)val << (32 - bw->accumBits - numBits);
+	bw->accumBits += numBits;
+	bw->bitLen += numBits;
+	uint8_t *p = &bw->buffer[(bw->bitLen - bw->accumBits) >> 3];
+	for (; bw->accumBits >= 8; bw->accumBits -= 8, bw->accum <<= 8)
+		*p++ = (uint8_t)(bw->accum >> 24);
+}
+
+
+// Appends the first numBits bits of the given big endian bit string. Whole bytes are copied directly
+// if the buffer is currently byte-aligned, otherwise 24 bits at a time are shifted into place.
+static void bitWriterAppendBits(struct BitWriter *bw, const uint8_t data[], int numBits) {
+	assert(numBits >= 0);
+	int i = 0;  // Number of bytes of data consumed
+	if (bw->accumBits == 0) {
+		memcpy(&bw->buffer[bw->bitLen >> 3], data, (size_t)(numBits >> 3) * sizeof(data[0]));
+		bw->bitLen += numBits & ~7;
+		i = numBits >> 3;
+	} else {
+		for (; (i + 3) * 8 <= numBits; i += 3)
+			bitWriterAppend(bw, (unsigned long)data[i] << 16 | (unsigned long)data[i + 1] << 8 | data[i + 2], 24);
+		for (; (i + 1) * 8 <= numBits; i++)
+			bitWriterAppend(bw, data[i], 8);
+	}
+	int rest = numBits - i * 8;  // In the range [0, 7]
+	if (rest > 0)
+		bitWriterAppend(bw, (unsigned long)data[i] >> (8 - rest), rest);
+}
+
+
+// Stores the pending partial byte, if any, with zeros in its unused low-order bits.
+static void bitWriterFinish(struct BitWriter *bw) {
+	if (bw->accumBits > 0)
+		bw->buffer[bw->bitLen >> 3] = (uint8_t)(bw->accum >> 24);
 }
 
 
@@ -207,22 +503,35 @@ bool qrcodegen_encodeSegments(const struct qrcodegen_Segment segs[], size_t len,
 // Public function - see documentation comment in header file.
 bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
 		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[]) {
+	return qrcodegen_encodeSegmentsScratch(segs, len, ecl, minVersion, maxVersion, mask, boostEcl,
+		tempBuffer, qrcode, NULL, 0);
+}
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_encodeSegmentsScratch(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[],
+		uint8_t scratch[], size_t scratchLen) {
+	return qrcodegen_encodeSegmentsText(segs, len, NULL, ecl, minVersion, maxVersion, mask, boostEcl,
+		tempBuffer, qrcode, scratch, scratchLen);
+}
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_encodeSegmentsText(const struct qrcodegen_Segment segs[], size_t len, const char text[],
+		enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl,
+		uint8_t tempBuffer[], uint8_t qrcode[], uint8_t scratch[], size_t scratchLen) {
 	assert(segs != NULL || len == 0);
-	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
-	assert(0 <= (int)ecl && (int)ecl <= 3 && -1 <= (int)mask && (int)mask <= 7);
+	assert(scratch != NULL || scratchLen == 0);
+	assert(0 <= (int)ecl && (int)ecl <= 3 && -2 <= (int)mask && (int)mask <= 7);
 	
 	// Find the minimal version number to use
-	int version, dataUsedBits;
-	for (version = minVersion; ; version++) {
-		int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;  // Number of data bits available
-		dataUsedBits = getTotalBits(segs, len, version);
-		if (dataUsedBits != LENGTH_OVERFLOW && dataUsedBits <= dataCapacityBits)
-			break;  // This version number is found to be suitable
-		if (version >= maxVersion) {  // All versions in the range could not fit the given data
-			qrcode[0] = 0;  // Set size to invalid value for safety
-			return false;
-		}
+	int version = qrcodegen_getMinVersion(segs, len, ecl, minVersion, maxVersion);
+	if (version == 0) {  // All versions in the range could not fit the given data
+		qrcode[0] = 0;  // Set size to invalid value for safety
+		return false;
 	}
+	int dataUsedBits = getTotalBits(segs, len, version);
 	assert(dataUsedBits != LENGTH_OVERFLOW);
 	
 	// Increase the error correction level while the data still fits in the current version number
@@ -233,47 +542,99 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 	
 	// Concatenate all segments to create the data bit string
 	memset(qrcode, 0, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version) * sizeof(qrcode[0]));
-	int bitLen = 0;
+	struct BitWriter bw;
+	bitWriterInit(&bw, qrcode, 0);
 	for (size_t i = 0; i < len; i++) {
 		const struct qrcodegen_Segment *seg = &segs[i];
-		appendBitsToBuffer((unsigned int)seg->mode, 4, qrcode, &bitLen);
-		appendBitsToBuffer((unsigned int)seg->numChars, numCharCountBits(seg->mode, version), qrcode, &bitLen);
-		for (int j = 0; j < seg->bitLength; j++) {
-			int bit = (seg->data[j >> 3] >> (7 - (j & 7))) & 1;
-			appendBitsToBuffer((unsigned int)bit, 1, qrcode, &bitLen);
-		}
+		bitWriterAppend(&bw, (unsigned int)seg->mode, 4);
+		bitWriterAppend(&bw, (unsigned int)seg->numChars, numCharCountBits(seg->mode, version));
+		if (text != NULL) {
+			appendChars(&bw, seg->mode, text, (size_t)seg->numChars);
+			text += seg->numChars;
+		} else
+			bitWriterAppendBits(&bw, seg->data, seg->bitLength);
 	}
-	assert(bitLen == dataUsedBits);
+	assert(bw.bitLen == dataUsedBits);
 	
 	// Add terminator and pad up to a byte if applicable
 	int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;
-	assert(bitLen <= dataCapacityBits);
-	int terminatorBits = dataCapacityBits - bitLen;
+	assert(bw.bitLen <= dataCapacityBits);
+	int terminatorBits = dataCapacityBits - bw.bitLen;
 	if (terminatorBits > 4)
 		terminatorBits = 4;
-	appendBitsToBuffer(0, terminatorBits, qrcode, &bitLen);
-	appendBitsToBuffer(0, (8 - bitLen % 8) % 8, qrcode, &bitLen);
-	assert(bitLen % 8 == 0);
+	bitWriterAppend(&bw, 0, terminatorBits);
+	bitWriterAppend(&bw, 0, (8 - bw.bitLen % 8) % 8);
+	assert(bw.bitLen % 8 == 0);
 	
 	// Pad with alternating bytes until data capacity is reached
-	for (uint8_t padByte = 0xEC; bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
-		appendBitsToBuffer(padByte, 8, qrcode, &bitLen);
+	for (uint8_t padByte = 0xEC; bw.bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
+		bitWriterAppend(&bw, padByte, 8);
+	bitWriterFinish(&bw);
 	
 	// Compute ECC, draw modules
 	addEccAndInterleave(qrcode, version, ecl, tempBuffer);
-	initializeFunctionModules(version, qrcode);
-	drawCodewords(tempBuffer, getNumRawDataModules(version) / 8, qrcode);
-	drawLightFunctionModules(qrcode, version);
-	initializeFunctionModules(version, tempBuffer);
+	const uint8_t *functionTemplate = getFunctionTemplate(version);
+	const uint16_t *placementMap = getPlacementMap(version);
+	if (functionTemplate != NULL) {
+		assert(placementMap != NULL);
+		size_t bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version);
+		memcpy(qrcode, functionTemplate, bufLen * sizeof(qrcode[0]));
+		drawCodewordsMapped(placementMap, tempBuffer, getNumRawDataModules(version) / 8, qrcode);
+		drawFunctionTemplate(functionTemplate, qrcode);
+		memcpy(tempBuffer, functionTemplate, bufLen * sizeof(tempBuffer[0]));
+	} else {
+		initializeFunctionModules(version, qrcode);
+		if (placementMap != NULL)
+			drawCodewordsMapped(placementMap, tempBuffer, getNumRawDataModules(version) / 8, qrcode);
+		else
+			drawCodewords(tempBuffer, getNumRawDataModules(version) / 8, qrcode);
+		drawLightFunctionModules(qrcode, version);
+		initializeFunctionModules(version, tempBuffer);
+	}
 	
 	// Do masking
-	if (mask == qrcodegen_Mask_AUTO) {  // Automatically choose best mask
+#if QRCODEGEN_MASK_THREADS > 1
+	if (mask == qrcodegen_Mask_AUTO) {
+		mask = chooseMaskThreaded(tempBuffer, qrcode, ecl);
+		if (mask != qrcodegen_Mask_AUTO)
+			return true;  // Already masked, with format bits
+	}
+#endif
+	size_t bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version);
+	int numCandidates = scratchLen / bufLen < 8 ? (int)(scratchLen / bufLen) : 8;
+	if ((mask == qrcodegen_Mask_AUTO || mask == qrcodegen_Mask_FAST) && numCandidates >= 2) {
+		// Build as many masked candidates as fit in the scratch space in one pass, then score each.
+		// Each candidate is abandoned as soon as its partial score can't beat the best so far.
+		bool fast = mask == qrcodegen_Mask_FAST;
+		long minPenalty = LONG_MAX;
+		for (int first = 0; first < 8; first += numCandidates) {
+			int count = 8 - first < numCandidates ? 8 - first : numCandidates;
+			applyMasks(tempBuffer, qrcode, first, count, scratch, bufLen);
+			for (int k = 0; k < count; k++) {
+				enum qrcodegen_Mask msk = (enum qrcodegen_Mask)(first + k);
+				uint8_t *candidate = &scratch[k * bufLen];
+				drawFormatBits(ecl, msk, candidate);
+				long penalty = fast ? getRowPenaltyScore(candidate, minPenalty) : getPenaltyScore(candidate, minPenalty);
+				if (penalty < minPenalty) {
+					mask = msk;
+					minPenalty = penalty;
+				}
+			}
+		}
+		if (numCandidates == 8) {  // The chosen candidate is complete, format bits included
+			memcpy(qrcode, &scratch[(int)mask * bufLen], bufLen * sizeof(qrcode[0]));
+			return true;
+		}
+	}
+	if (mask == qrcodegen_Mask_AUTO || mask == qrcodegen_Mask_FAST) {  // Automatically choose best mask
+		// Each candidate is abandoned as soon as its partial score can't beat the best so far
+		bool fast = mask == qrcodegen_Mask_FAST;
 		long minPenalty = LONG_MAX;
 		for (int i = 0; i < 8; i++) {
 			enum qrcodegen_Mask msk = (enum qrcodegen_Mask)i;
 			applyMask(tempBuffer, qrcode, msk);
 			drawFormatBits(ecl, msk, qrcode);
-			long penalty = getPenaltyScore(qrcode);
+			long penalty = fast ? getRowPenaltyScore(qrcode, minPenalty) : getPenaltyScore(qrcode, minPenalty);
 			if (penalty < minPenalty) {
 				mask = msk;
 				minPenalty = penalty;
@@ -289,13 +650,28 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 
 
 
+// Public function - see documentation comment in header file.
+int qrcodegen_getMinVersion(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+		int minVersion, int maxVersion) {
+	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
+	assert(0 <= (int)ecl && (int)ecl <= 3);
+	for (int version = minVersion; version <= maxVersion; version++) {
+		int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;  // Number of data bits available
+		int dataUsedBits = getTotalBits(segs, len, version);
+		if (dataUsedBits != LENGTH_OVERFLOW && dataUsedBits <= dataCapacityBits)
+			return version;  // This version number is found to be suitable
+	}
+	return 0;
+}
+
+
+
 /*---- Error correction code generation functions ----*/
 
 // Appends error correction bytes to each block of the given data array, then interleaves
 // bytes from the blocks and stores them in the result array. data[0 : dataLen] contains
-// the input data. data[dataLen : rawCodewords] is used as a temporary work area and will
-// be clobbered by this function. The final answer is stored in result[0 : rawCodewords].
-testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]) {
+// the input data, and is not modified. The final answer is stored in result[0 : rawCodewords].
+testable void addEccAndInterleave(const uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]) {
 	// Calculate parameter numbers
 	assert(0 <= (int)ecl && (int)ecl < 4 && qrcodegen_VERSION_MIN <= version && version <= qrcodegen_VERSION_MAX);
 	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[(int)ecl][version];
@@ -305,24 +681,23 @@ testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ec
 	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
 	int shortBlockDataLen = rawCodewords / numBlocks - blockEccLen;
 	
-	// Split data into blocks, calculate ECC, and interleave
-	// (not concatenate) the bytes into a single sequence
-	uint8_t rsdiv[qrcodegen_REED_SOLOMON_DEGREE_MAX];
-	reedSolomonComputeDivisor(blockEccLen, rsdiv);
+	// Split data into blocks, and interleave (not concatenate) their bytes into a single sequence
 	const uint8_t *dat = data;
 	for (int i = 0; i < numBlocks; i++) {
 		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
-		uint8_t *ecc = &data[dataLen];  // Temporary storage
-		reedSolomonComputeRemainder(dat, datLen, rsdiv, blockEccLen, ecc);
-		for (int j = 0, k = i; j < datLen; j++, k += numBlocks) {  // Copy data
+		for (int j = 0, k = i; j < datLen; j++, k += numBlocks) {
 			if (j == shortBlockDataLen)
 				k -= numShortBlocks;
 			result[k] = dat[j];
 		}
-		for (int j = 0, k = dataLen + i; j < blockEccLen; j++, k += numBlocks)  // Copy ECC
-			result[k] = ecc[j];
 		dat += datLen;
 	}
+	
+	// Calculate the ECC of all blocks at once, straight into their interleaved positions
+	uint8_t rsdivBuf[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+	const uint8_t *rsdiv = reedSolomonGetDivisor(blockEccLen, rsdivBuf);
+	reedSolomonComputeRemainders(result, numBlocks, numShortBlocks, shortBlockDataLen,
+		rsdiv, blockEccLen, &result[dataLen]);
 }
 
 
@@ -331,17 +706,25 @@ testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ec
 testable int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl) {
 	int v = version, e = (int)ecl;
 	assert(0 <= e && e < 4);
+#if defined(QRCODEGEN_GENERATED_TABLES)
+	assert(qrcodegen_VERSION_MIN <= v && v <= qrcodegen_VERSION_MAX);
+	return NUM_DATA_CODEWORDS[e][v];
+#else
 	return getNumRawDataModules(v) / 8
 		- ECC_CODEWORDS_PER_BLOCK    [e][v]
 		* NUM_ERROR_CORRECTION_BLOCKS[e][v];
+#endif
 }
 
 
 // Returns the number of data bits that can be stored in a QR Code of the given version number, after
 // all function modules are excluded. This includes remainder bits, so it might not be a multiple of 8.
-// The result is in the range [208, 29648]. This could be implemented as a 40-entry lookup table.
+// The result is in the range [208, 29648]. This is a 40-entry lookup table if built with QRCODEGEN_GENERATED_TABLES.
 testable int getNumRawDataModules(int ver) {
 	assert(qrcodegen_VERSION_MIN <= ver && ver <= qrcodegen_VERSION_MAX);
+#if defined(QRCODEGEN_GENERATED_TABLES)
+	return NUM_RAW_DATA_MODULES[ver];
+#else
 	int result = (16 * ver + 128) * ver + 64;
 	if (ver >= 2) {
 		int numAlign = ver / 7 + 2;
@@ -351,6 +734,7 @@ testable int getNumRawDataModules(int ver) {
 	}
 	assert(208 <= result && result <= 29648);
 	return result;
+#endif
 }
 
 
@@ -358,7 +742,7 @@ testable int getNumRawDataModules(int ver) {
 /*---- Reed-Solomon ECC generator functions ----*/
 
 // Computes a Reed-Solomon ECC generator polynomial for the given degree, storing in result[0 : degree].
-// This could be implemented as a lookup table over all possible parameter values, instead of as an algorithm.
+// With QRCODEGEN_RS_TABLES, reedSolomonGetDivisor() looks up the degrees used by QR Codes instead.
 testable void reedSolomonComputeDivisor(int degree, uint8_t result[]) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
 	// Polynomial coefficients are stored from highest to lowest power, excluding the leading term which is always 1.
@@ -382,28 +766,124 @@ testable void reedSolomonComputeDivisor(int degree, uint8_t result[]) {
 }
 
 
-// Computes the Reed-Solomon error correction codeword for the given data and divisor polynomials.
-// The remainder when data[0 : dataLen] is divided by divisor[0 : degree] is stored in result[0 : degree].
+// Returns the Reed-Solomon generator polynomial for the given degree, which is either a pointer
+// into the constant table or buf[0 : degree] after computing the polynomial there.
+static const uint8_t *reedSolomonGetDivisor(int degree, uint8_t buf[]) {
+	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
+#if QRCODEGEN_RS_TABLES
+	if (REED_SOLOMON_GENERATOR_OFFSET[degree] >= 0)
+		return &REED_SOLOMON_GENERATORS[REED_SOLOMON_GENERATOR_OFFSET[degree]];
+#endif
+	reedSolomonComputeDivisor(degree, buf);
+	return buf;
+}
+
+
+// Computes the Reed-Solomon error correction codewords of numBlocks blocks together, for the given
+// divisor polynomial. The data is read in its interleaved order: byte j of block i is data[j * numBlocks + i]
+// for j < shortBlockDataLen, and the last byte of each long block i >= numShortBlocks is
+// data[shortBlockDataLen * numBlocks + i - numShortBlocks]. Byte j of the remainder of block i is
+// stored in result[j * numBlocks + i], which is the interleaved order of the ECC bytes in a QR Code.
 // All polynomials are in big endian, and the generator has an implicit leading 1 term.
-testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
-		const uint8_t generator[], int degree, uint8_t result[]) {
+// With QRCODEGEN_RS_TABLES each product is a table lookup, otherwise each step of the polynomial
+// division handles a word of blocks in parallel, one block per byte lane.
+testable void reedSolomonComputeRemainders(const uint8_t data[], int numBlocks, int numShortBlocks,
+		int shortBlockDataLen, const uint8_t generator[], int degree, uint8_t result[]) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
-	memset(result, 0, (size_t)degree * sizeof(result[0]));
-	for (int i = 0; i < dataLen; i++) {  // Polynomial division
-		uint8_t factor = data[i] ^ result[0];
-		memmove(&result[0], &result[1], (size_t)(degree - 1) * sizeof(result[0]));
-		result[degree - 1] = 0;
-		for (int j = 0; j < degree; j++)
-			result[j] ^= reedSolomonMultiply(generator[j], factor);
+	assert(1 <= numBlocks && numBlocks <= qrcodegen_ECC_BLOCKS_MAX && 0 < numShortBlocks && numShortBlocks <= numBlocks);
+	memset(result, 0, (size_t)(degree * numBlocks) * sizeof(result[0]));
+#if QRCODEGEN_RS_TABLES
+	uint8_t genLog[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+	for (int j = 0; j < degree; j++) {
+		assert(generator[j] != 0);
+		genLog[j] = REED_SOLOMON_LOG[generator[j]];
+	}
+#endif
+	for (int i = 0; i <= shortBlockDataLen; i++) {  // Polynomial division
+		int first = (i < shortBlockDataLen) ? 0 : numShortBlocks;  // Only the long blocks have a last byte
+		const uint8_t *row = &data[i * numBlocks - first];
+#if QRCODEGEN_RS_TABLES
+		for (int b = first; b < numBlocks; b++) {
+			// Shift this block's remainder by one byte and subtract factor * generator
+			uint8_t factor = row[b] ^ result[b];
+			uint8_t *rem = &result[b];
+			int j = 0;
+			if (factor != 0) {
+				const uint8_t *expRow = &REED_SOLOMON_EXP[REED_SOLOMON_LOG[factor]];
+				for (; j < degree - 1; j++, rem += numBlocks)
+					rem[0] = rem[numBlocks] ^ expRow[genLog[j]];
+				rem[0] = expRow[genLog[j]];
+			} else {
+				for (; j < degree - 1; j++, rem += numBlocks)
+					rem[0] = rem[numBlocks];
+				rem[0] = 0;
+			}
+		}
+#else
+		for (int b = first; b < numBlocks; b += (int)sizeof(rs_lanes_t)) {
+			int n = numBlocks - b;
+			if (n > (int)sizeof(rs_lanes_t))
+				n = (int)sizeof(rs_lanes_t);
+			
+			// The factor of each lane, times each power of 2
+			rs_lanes_t factors[8];
+			factors[0] = reedSolomonLoadLanes(&row[b], n) ^ reedSolomonLoadLanes(&result[b], n);
+			for (int k = 1; k < 8; k++)
+				factors[k] = reedSolomonMultiplyLanesByTwo(factors[k - 1]);
+			
+			// Shift each remainder by one byte and subtract factor * generator
+			for (int j = 0; j < degree; j++) {
+				rs_lanes_t sum = (j + 1 < degree) ? reedSolomonLoadLanes(&result[(j + 1) * numBlocks + b], n) : 0;
+				for (int k = 0; k < 8; k++)
+					sum ^= factors[k] & (0 - (rs_lanes_t)((generator[j] >> k) & 1));
+				reedSolomonStoreLanes(&result[j * numBlocks + b], sum, n);
+			}
+		}
+#endif
 	}
 }
 
+
+#if !QRCODEGEN_RS_TABLES
+// Returns src[0 : n] as the lowest-addressed byte lanes of a word, with zeros in the other lanes.
+static rs_lanes_t reedSolomonLoadLanes(const uint8_t src[], int n) {
+	rs_lanes_t result = 0;
+	if (n == (int)sizeof(result))
+		memcpy(&result, src, sizeof(result));
+	else
+		memcpy(&result, src, (size_t)n);
+	return result;
+}
+
+
+// Stores the lowest-addressed n byte lanes of the given word into dest[0 : n].
+static void reedSolomonStoreLanes(uint8_t dest[], rs_lanes_t lanes, int n) {
+	if (n == (int)sizeof(lanes))
+		memcpy(dest, &lanes, sizeof(lanes));
+	else
+		memcpy(dest, &lanes, (size_t)n);
+}
+
+
+// Returns the product of each byte lane with 0x02 modulo GF(2^8/0x11D).
+static rs_lanes_t reedSolomonMultiplyLanesByTwo(rs_lanes_t x) {
+	const rs_lanes_t ones = (rs_lanes_t)-1 / 0xFF;  // 0x01 in every lane
+	return ((x & ones * 0x7F) << 1) ^ (((x >> 7) & ones) * 0x1D);
+}
+#endif
+
 #undef qrcodegen_REED_SOLOMON_DEGREE_MAX
+#undef qrcodegen_ECC_BLOCKS_MAX
 
 
 // Returns the product of the two given field elements modulo GF(2^8/0x11D).
-// All inputs are valid. This could be implemented as a 256*256 lookup table.
+// All inputs are valid. With QRCODEGEN_RS_TABLES this uses the log/antilog tables.
 testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
+#if QRCODEGEN_RS_TABLES
+	if (x == 0 || y == 0)
+		return 0;
+	return REED_SOLOMON_EXP[REED_SOLOMON_LOG[x] + REED_SOLOMON_LOG[y]];
+#else
 	// Russian peasant multiplication
 	uint8_t z = 0;
 	for (int i = 7; i >= 0; i--) {
@@ -411,6 +891,7 @@ testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
 		z ^= ((y >> i) & 1) * x;
 	}
 	return z;
+#endif
 }
 
 
@@ -494,11 +975,15 @@ static void drawLightFunctionModules(uint8_t qrcode[], int version) {
 	
 	// Draw version blocks
 	if (version >= 7) {
+#if defined(QRCODEGEN_GENERATED_TABLES)
+		long bits = (long)VERSION_BITS[version];
+#else
 		// Calculate error correction code and pack bits
 		int rem = version;  // version is uint6, in the range [7, 40]
 		for (int i = 0; i < 12; i++)
 			rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
 		long bits = (long)version << 12 | rem;  // uint18
+#endif
 		assert(bits >> 18 == 0);
 		
 		// Draw two copies
@@ -514,18 +999,83 @@ static void drawLightFunctionModules(uint8_t qrcode[], int version) {
 }
 
 
+// Returns the function module template for the given version, or NULL if the version isn't cached.
+// A template is two buffers of qrcodegen_BUFFER_LEN_FOR_VERSION(version) bytes each: the state after
+// initializeFunctionModules(), followed by the state after also calling drawLightFunctionModules().
+static const uint8_t *getFunctionTemplate(int version) {
+	assert(qrcodegen_VERSION_MIN <= version && version <= qrcodegen_VERSION_MAX);
+#if QRCODEGEN_CACHE_VERSION_MAX > 0
+	if (version > QRCODEGEN_CACHE_VERSION_MAX)
+		return NULL;
+	uint8_t *result = functionTemplateCache;
+	for (int v = qrcodegen_VERSION_MIN; v < version; v++)
+		result += 2 * qrcodegen_BUFFER_LEN_FOR_VERSION(v);
+	if (result[0] == 0) {  // Not built yet
+		size_t bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version);
+		uint8_t *patterns = &result[bufLen];
+		initializeFunctionModules(version, patterns);
+		drawLightFunctionModules(patterns, version);
+		initializeFunctionModules(version, result);  // Its nonzero size byte marks the template as built
+	}
+	return result;
+#else
+	return NULL;
+#endif
+}
+
+
+// Returns the codeword placement map for the given version, or NULL if the version isn't cached.
+// Maps come from the generated tables if they were built in, otherwise from the RAM cache.
+static const uint16_t *getPlacementMap(int version) {
+	assert(qrcodegen_VERSION_MIN <= version && version <= qrcodegen_VERSION_MAX);
+#if defined(QRCODEGEN_GENERATED_TABLES)
+	if (version > QRCODEGEN_TABLES_VERSION_MAX)
+		return NULL;
+	return &PLACEMENT_MAPS[PLACEMENT_MAP_OFFSETS[version - 1]];
+#elif QRCODEGEN_CACHE_VERSION_MAX > 0
+	const uint8_t *functionTemplate = getFunctionTemplate(version);
+	if (functionTemplate == NULL)
+		return NULL;
+	uint16_t *result = placementMapCache;
+	for (int v = qrcodegen_VERSION_MIN; v < version; v++)
+		result += qrcodegen_PLACEMENT_MAP_LEN_(v);
+	if (result[0] == 0)  // Not built yet; every version has at least one run
+		buildPlacementMap(functionTemplate, result);
+	return result;
+#else
+	return NULL;
+#endif
+}
+
+
+// Draws the function patterns of the given template onto the given QR Code, the same as
+// drawLightFunctionModules() does. Requires every function module to be dark beforehand.
+static void drawFunctionTemplate(const uint8_t functionTemplate[], uint8_t qrcode[]) {
+	int qrsize = qrcodegen_getSize(qrcode);
+	assert(functionTemplate[0] == qrsize);
+	int bufLen = (qrsize * qrsize + 7) / 8 + 1;
+	const uint8_t *patterns = &functionTemplate[bufLen];
+	for (int i = 1; i < bufLen; i++)
+		qrcode[i] &= patterns[i] | (uint8_t)~functionTemplate[i];
+}
+
+
 // Draws two copies of the format bits (with its own error correction code) based
 // on the given mask and error correction level. This always draws all modules of
 // the format bits, unlike drawLightFunctionModules() which might skip dark modules.
 static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]) {
 	// Calculate error correction code and pack bits
 	assert(0 <= (int)mask && (int)mask <= 7);
+#if defined(QRCODEGEN_GENERATED_TABLES)
+	int bits = FORMAT_BITS[(int)ecl][(int)mask];
+#else
 	static const int table[] = {1, 0, 3, 2};
 	int data = table[(int)ecl] << 3 | (int)mask;  // errCorrLvl is uint2, mask is uint3
 	int rem = data;
 	for (int i = 0; i < 10; i++)
 		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
 	int bits = (data << 10 | rem) ^ 0x5412;  // uint15
+#endif
 	assert(bits >> 15 == 0);
 	
 	// Draw first copy
@@ -550,16 +1100,20 @@ static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uin
 // Calculates and stores an ascending list of positions of alignment patterns
 // for this version number, returning the length of the list (in the range [0,7]).
 // Each position is in the range [0,177), and are used on both the x and y axes.
-// This could be implemented as lookup table of 40 variable-length lists of unsigned bytes.
+// This is a lookup table of 40 variable-length lists of unsigned bytes if built with QRCODEGEN_GENERATED_TABLES.
 testable int getAlignmentPatternPositions(int version, uint8_t result[7]) {
 	if (version == 1)
 		return 0;
 	int numAlign = version / 7 + 2;
+#if defined(QRCODEGEN_GENERATED_TABLES)
+	memcpy(result, ALIGNMENT_PATTERN_POSITIONS[version], (size_t)numAlign * sizeof(result[0]));
+#else
 	int step = (version == 32) ? 26 :
 		(version * 4 + numAlign * 2 + 1) / (numAlign * 2 - 2) * 2;
 	for (int i = numAlign - 1, pos = version * 4 + 10; i >= 1; i--, pos -= step)
 		result[i] = (uint8_t)pos;
 	result[0] = 6;
+#endif
 	return numAlign;
 }
 
@@ -604,6 +1158,149 @@ static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
 }
 
 
+#if !defined(QRCODEGEN_GENERATED_TABLES) && QRCODEGEN_CACHE_VERSION_MAX > 0
+// Fills the given array with the placement map of the QR Code whose function modules are dark in the given
+// buffer, and returns the number of uint16 used. The modules visited by the zigzag scan of drawCodewords()
+// are numbered consecutively, two per row of each column pair, and the map lists the runs of codeword modules
+// in that order: the number of runs, then the first module number and the length of each run. Runs are
+// split where the scan moves to the next column pair, so each one is a simple walk up or down two columns.
+// A version has at most 12 * version + 12 runs, which qrcodegen_PLACEMENT_MAP_LEN_() allows for.
+testable int buildPlacementMap(const uint8_t functionModules[], uint16_t result[]) {
+	int qrsize = qrcodegen_getSize(functionModules);
+	int numRuns = 0;
+	int n = 0;  // Number of the current module in the zigzag scan
+	for (int right = qrsize - 1; right >= 1; right -= 2) {  // Same scan as drawCodewords()
+		if (right == 6)
+			right = 5;
+		bool inRun = false;
+		for (int vert = 0; vert < qrsize; vert++) {
+			for (int j = 0; j < 2; j++, n++) {
+				bool upward = ((right + 1) & 2) == 0;
+				int y = upward ? qrsize - 1 - vert : vert;
+				if (getModuleBounded(functionModules, right - j, y))
+					inRun = false;
+				else if (inRun)
+					result[numRuns * 2]++;
+				else {
+					numRuns++;
+					result[numRuns * 2 - 1] = (uint16_t)n;
+					result[numRuns * 2] = 1;
+					inRun = true;
+				}
+			}
+		}
+	}
+	assert(numRuns <= 12 * ((qrsize - 17) / 4) + 12);
+	result[0] = (uint16_t)numRuns;
+	return numRuns * 2 + 1;
+}
+#endif
+
+
+
+// Draws the raw codewords onto the given QR Code, the same as drawCodewords() does, but
+// only visiting codeword modules by following the given map from buildPlacementMap().
+// This requires the initial state of the QR Code to be light at codeword modules.
+static void drawCodewordsMapped(const uint16_t placementMap[], const uint8_t data[], int dataLen, uint8_t qrcode[]) {
+	int qrsize = qrcodegen_getSize(qrcode);
+	int numBits = dataLen * 8;
+	int i = 0;  // Bit index into the data
+	for (int r = 0; r < placementMap[0] && i < numBits; r++) {
+		int start = placementMap[r * 2 + 1];
+		int end = i + placementMap[r * 2 + 2];
+		if (end > numBits)
+			end = numBits;
+		
+		// Find the run's first module, then step along the zigzag
+		int right = qrsize - 1 - start / (qrsize * 2) * 2;
+		if (right <= 6)
+			right--;
+		int vert = start % (qrsize * 2) / 2;
+		int j = start % 2;
+		bool upward = ((right + 1) & 2) == 0;
+		int y = upward ? qrsize - 1 - vert : vert;
+		int index = y * qrsize + right - j;  // Bit index into the modules
+		int rowStep = (upward ? -qrsize : qrsize) + 1;
+		for (; i < end; i++) {
+			if ((data[i >> 3] >> (7 - (i & 7))) & 1)
+				qrcode[(index >> 3) + 1] |= 1 << (index & 7);
+			index += j == 0 ? -1 : rowStep;
+			j ^= 1;
+		}
+	}
+	assert(i == numBits);
+}
+
+
+#if QRCODEGEN_MASK_THREADS > 1
+// Chooses the same mask as the serial loop in qrcodegen_encodeSegmentsAdvanced(), but builds and scores
+// each candidate in a buffer of its own, on up to QRCODEGEN_MASK_THREADS threads. The chosen candidate is
+// copied into qrcode, already masked with its format bits drawn. Returns qrcodegen_Mask_AUTO and leaves
+// qrcode unchanged if threads aren't worthwhile for this size, or can't be had.
+static enum qrcodegen_Mask chooseMaskThreaded(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Ecc ecl) {
+	int version = (qrcodegen_getSize(qrcode) - 17) / 4;
+	if (version < MASK_THREADS_MIN_VERSION)
+		return qrcodegen_Mask_AUTO;
+	long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int numThreads = numCpus < QRCODEGEN_MASK_THREADS ? (int)numCpus : QRCODEGEN_MASK_THREADS;
+	if (numThreads <= 1)
+		return qrcodegen_Mask_AUTO;
+	
+	struct MaskSearch search;
+	search.functionModules = functionModules;
+	search.qrcode = qrcode;
+	search.bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version);
+	search.ecl = ecl;
+	search.nextMask = 0;
+	search.candidates = malloc(8 * search.bufLen);
+	if (search.candidates == NULL)
+		return qrcodegen_Mask_AUTO;
+	if (pthread_mutex_init(&search.lock, NULL) != 0) {
+		free(search.candidates);
+		return qrcodegen_Mask_AUTO;
+	}
+	
+	// This thread works too, alongside however many others could be started
+	pthread_t threads[QRCODEGEN_MASK_THREADS - 1];
+	int numStarted = 0;
+	while (numStarted < numThreads - 1 && pthread_create(&threads[numStarted], NULL, scoreMaskCandidates, &search) == 0)
+		numStarted++;
+	scoreMaskCandidates(&search);
+	for (int i = 0; i < numStarted; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&search.lock);
+	
+	// Ties go to the lowest mask number, as in the serial loop
+	int result = 0;
+	for (int i = 1; i < 8; i++) {
+		if (search.penalties[i] < search.penalties[result])
+			result = i;
+	}
+	memcpy(qrcode, &search.candidates[result * search.bufLen], search.bufLen);
+	free(search.candidates);
+	return (enum qrcodegen_Mask)result;
+}
+
+
+// Masks and scores candidates until none are left. The thread function for chooseMaskThreaded().
+static void *scoreMaskCandidates(void *arg) {
+	struct MaskSearch *search = arg;
+	while (true) {
+		pthread_mutex_lock(&search->lock);
+		int i = search->nextMask++;
+		pthread_mutex_unlock(&search->lock);
+		if (i >= 8)
+			return NULL;
+		uint8_t *candidate = &search->candidates[i * search->bufLen];
+		memcpy(candidate, search->qrcode, search->bufLen);
+		applyMask(search->functionModules, candidate, (enum qrcodegen_Mask)i);
+		drawFormatBits(search->ecl, (enum qrcodegen_Mask)i, candidate);
+		search->penalties[i] = getPenaltyScore(candidate, LONG_MAX);
+	}
+}
+#endif
+
+
 // XORs the codeword modules in this QR Code with the given mask pattern
 // and given pattern of function modules. The codeword bits must be drawn
 // before masking. Due to the arithmetic of XOR, calling applyMask() with
@@ -611,25 +1308,39 @@ static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
 // QR Code needs exactly one (not zero, two, etc.) mask applied.
 static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask) {
 	assert(0 <= (int)mask && (int)mask <= 7);  // Disallows qrcodegen_Mask_AUTO
+	applyMasks(functionModules, qrcode, (int)mask, 1, qrcode, 0);
+}
+
+
+// Writes count copies of the given QR Code to consecutive buffers of bufLen bytes starting at result,
+// masked with the patterns firstMask, firstMask + 1, etc., in a single pass over the QR Code. The format
+// bits are left as they were. With a count of 1, result may be the QR Code itself, which is masked in place.
+static void applyMasks(const uint8_t functionModules[], const uint8_t qrcode[], int firstMask, int count,
+		uint8_t result[], size_t bufLen) {
+	assert(0 <= firstMask && 1 <= count && firstMask + count <= 8);
 	int qrsize = qrcodegen_getSize(qrcode);
+	for (int k = 0; k < count; k++)
+		result[k * bufLen] = qrcode[0];
+	// Build the mask bitplanes in the same layout as the modules, a whole byte at a time,
+	// and XOR each byte into the QR Code wherever it isn't a function module
+	uint32_t accums[8] = {0};
+	int accumBits = 0;
+	size_t i = 1;  // Byte index into the buffers
 	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModuleBounded(functionModules, x, y))
-				continue;
-			bool invert;
-			switch ((int)mask) {
-				case 0:  invert = (x + y) % 2 == 0;                    break;
-				case 1:  invert = y % 2 == 0;                          break;
-				case 2:  invert = x % 3 == 0;                          break;
-				case 3:  invert = (x + y) % 3 == 0;                    break;
-				case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
-				case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
-				case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
-				case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
-				default:  assert(false);  return;
+		for (int x = 0; x < qrsize; x += 24) {  // Multiples of 6, so every chunk starts in phase
+			int n = qrsize - x < 24 ? qrsize - x : 24;
+			uint32_t chunk = (UINT32_C(1) << n) - 1;
+			for (int k = 0; k < count; k++)
+				accums[k] |= (MASK_ROW_PATTERNS[firstMask + k][y % 12] & chunk) << accumBits;
+			accumBits += n;
+			bool last = y == qrsize - 1 && x + n == qrsize;  // Flush the final partial byte
+			for (; accumBits >= 8 || (last && accumBits > 0); accumBits -= 8, i++) {
+				uint8_t codewordModules = (uint8_t)~functionModules[i];
+				for (int k = 0; k < count; k++) {
+					result[k * bufLen + i] = qrcode[i] ^ ((uint8_t)accums[k] & codewordModules);
+					accums[k] >>= 8;
+				}
 			}
-			bool val = getModuleBounded(qrcode, x, y);
-			setModuleBounded(qrcode, x, y, val ^ invert);
 		}
 	}
 }
@@ -637,84 +1348,144 @@ static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qr
 
 // Calculates and returns the penalty score based on state of the given QR Code's current modules.
 // This is used by the automatic mask choice algorithm to find the mask pattern that yields the lowest score.
-static long getPenaltyScore(const uint8_t qrcode[]) {
+// Every rule only adds points, so scoring stops early and returns the partial total, which is at least
+// limit, as soon as the total reaches limit. Pass LONG_MAX to always get the full score.
+static long getPenaltyScore(const uint8_t qrcode[], long limit) {
+	long result = getRowPenaltyScore(qrcode, limit);
+	if (result >= limit)
+		return result;
 	int qrsize = qrcodegen_getSize(qrcode);
-	long result = 0;
+	int numWords = (qrsize + 31) / 32;
 	
-	// Adjacent modules in row having same color, and finder-like patterns
-	for (int y = 0; y < qrsize; y++) {
-		bool runColor = false;
-		int runX = 0;
-		int runHistory[7] = {0};
-		for (int x = 0; x < qrsize; x++) {
-			if (getModuleBounded(qrcode, x, y) == runColor) {
-				runX++;
-				if (runX == 5)
-					result += PENALTY_N1;
-				else if (runX > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runX, runHistory, qrsize);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModuleBounded(qrcode, x, y);
-				runX = 1;
-			}
+	// Adjacent modules in column having same color, and finder-like patterns. Each strip of a few
+	// columns is transposed a block at a time, so that every column becomes a line of words.
+	for (int left = 0; left < qrsize; left += PENALTY_STRIP_COLUMNS) {
+		int width = qrsize - left < PENALTY_STRIP_COLUMNS ? qrsize - left : PENALTY_STRIP_COLUMNS;
+		uint32_t columns[PENALTY_STRIP_COLUMNS][PENALTY_LINE_WORDS];
+		for (int i = 0; i < numWords; i++) {
+			uint32_t block[32] = {0};
+			for (int j = 0; j < 32 && i * 32 + j < qrsize; j++)
+				block[j] = getModuleWord(qrcode, (i * 32 + j) * qrsize + left, width);
+			transposeModuleBlock(block);
+			for (int j = 0; j < width; j++)
+				columns[j][i] = block[j];
 		}
-		result += finderPenaltyTerminateAndCount(runColor, runX, runHistory, qrsize) * PENALTY_N3;
+		for (int j = 0; j < width; j++)
+			result += getLinePenaltyScore(columns[j], qrsize);
+		if (result >= limit)
+			return result;
 	}
-	// Adjacent modules in column having same color, and finder-like patterns
-	for (int x = 0; x < qrsize; x++) {
-		bool runColor = false;
-		int runY = 0;
-		int runHistory[7] = {0};
-		for (int y = 0; y < qrsize; y++) {
-			if (getModuleBounded(qrcode, x, y) == runColor) {
-				runY++;
-				if (runY == 5)
-					result += PENALTY_N1;
-				else if (runY > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runY, runHistory, qrsize);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModuleBounded(qrcode, x, y);
-				runY = 1;
+	assert(0 <= result && result <= 2568888L);  // Non-tight upper bound based on default values of PENALTY_N1, ..., N4
+	return result;
+}
+
+
+// Returns the part of getPenaltyScore() that can be scored a row at a time: the balance of dark and light
+// modules, 2*2 blocks, and the runs and finder-like patterns of rows but not columns. Stops early at the
+// given limit in the same way. Used alone, this gives the quicker estimate behind qrcodegen_Mask_FAST.
+static long getRowPenaltyScore(const uint8_t qrcode[], long limit) {
+	int qrsize = qrcodegen_getSize(qrcode);
+	int numWords = (qrsize + 31) / 32;
+	
+	// Balance of dark and light modules, first since it is the cheapest rule to score
+	int total = qrsize * qrsize;  // Note that size is odd, so dark/total != 1/2
+	int dark = 0;
+	for (int i = 0; i < total; i += 32)
+		dark += countOnes(getModuleWord(qrcode, i, total - i < 32 ? total - i : 32));
+	// Compute the smallest integer k >= 0 such that (45-5k)% <= dark/total <= (55+5k)%
+	int k = (int)((labs(dark * 20L - total * 10L) + total - 1) / total) - 1;
+	assert(0 <= k && k <= 9);
+	long result = k * PENALTY_N4;
+	
+	// Each line of modules is handled as an array of words, with module i at bit i % 32 of word i / 32
+	uint32_t line[PENALTY_LINE_WORDS];
+	uint32_t prevLine[PENALTY_LINE_WORDS];
+	for (int y = 0; y < qrsize; y++) {
+		for (int i = 0; i < numWords; i++) {
+			int count = qrsize - i * 32 < 32 ? qrsize - i * 32 : 32;
+			line[i] = getModuleWord(qrcode, y * qrsize + i * 32, count);
+		}
+		
+		// Adjacent modules in row having same color, and finder-like patterns
+		result += getLinePenaltyScore(line, qrsize);
+		
+		// 2*2 blocks of modules having same color, with their top left corner in the previous row
+		if (y > 0) {
+			for (int i = 0; i < numWords; i++) {
+				uint32_t same = ~(prevLine[i] ^ line[i]);  // Vertical pairs
+				uint32_t next = i + 1 < numWords ? ~(prevLine[i + 1] ^ line[i + 1]) : 0;
+				uint32_t rowNext = i + 1 < numWords ? line[i + 1] : 0;
+				same &= same >> 1 | next << 31;  // And the pair to its right
+				same &= ~(line[i] ^ (line[i] >> 1 | rowNext << 31));  // And both pairs the same color
+				int count = qrsize - 1 - i * 32 < 32 ? qrsize - 1 - i * 32 : 32;  // Columns 0 to qrsize-2
+				if (count < 32)
+					same &= (UINT32_C(1) << count) - 1;
+				result += countOnes(same) * PENALTY_N2;
 			}
 		}
-		result += finderPenaltyTerminateAndCount(runColor, runY, runHistory, qrsize) * PENALTY_N3;
+		if (result >= limit)
+			return result;
+		memcpy(prevLine, line, sizeof(line));
 	}
-	
-	// 2*2 blocks of modules having same color
-	for (int y = 0; y < qrsize - 1; y++) {
-		for (int x = 0; x < qrsize - 1; x++) {
-			bool  color = getModuleBounded(qrcode, x, y);
-			if (  color == getModuleBounded(qrcode, x + 1, y) &&
-			      color == getModuleBounded(qrcode, x, y + 1) &&
-			      color == getModuleBounded(qrcode, x + 1, y + 1))
-				result += PENALTY_N2;
+	return result;
+}
+
+
+// Returns the penalty points for runs of the same color and finder-like patterns in the given row or
+// column of modules, stored as in getPenaltyScore(). Whole runs are found by scanning a word at a time
+// for the next change of color, then fed to the finder pattern history one run at a time.
+static long getLinePenaltyScore(const uint32_t line[], int qrsize) {
+	long result = 0;
+	bool runColor = false;
+	int runLen = 0;
+	int runHistory[7] = {0};
+	for (int x = 0; x < qrsize; ) {
+		// Find the end of the run starting at x. Bits past the end of the line are light.
+		bool color = ((line[x >> 5] >> (x & 31)) & 1) != 0;
+		uint32_t flip = color ? UINT32_MAX : 0;
+		int end = x;
+		uint32_t changes = (line[end >> 5] ^ flip) >> (end & 31);
+		while (changes == 0 && (end | 31) + 1 < qrsize) {
+			end = (end | 31) + 1;
+			changes = line[end >> 5] ^ flip;
 		}
-	}
-	
-	// Balance of dark and light modules
-	int dark = 0;
-	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModuleBounded(qrcode, x, y))
-				dark++;
+		end = changes != 0 ? end + countTrailingZeros(changes) : qrsize;
+		if (end > qrsize)
+			end = qrsize;
+		
+		int len = end - x;
+		if (len >= 5)
+			result += PENALTY_N1 + (len - 5);
+		if (color == runColor)  // Only a light run at the start of the line
+			runLen += len;
+		else {
+			finderPenaltyAddHistory(runLen, runHistory, qrsize);
+			if (!runColor)
+				result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
+			runColor = color;
+			runLen = len;
 		}
+		x = end;
 	}
-	int total = qrsize * qrsize;  // Note that size is odd, so dark/total != 1/2
-	// Compute the smallest integer k >= 0 such that (45-5k)% <= dark/total <= (55+5k)%
-	int k = (int)((labs(dark * 20L - total * 10L) + total - 1) / total) - 1;
-	assert(0 <= k && k <= 9);
-	result += k * PENALTY_N4;
-	assert(0 <= result && result <= 2568888L);  // Non-tight upper bound based on default values of PENALTY_N1, ..., N4
+	result += finderPenaltyTerminateAndCount(runColor, runLen, runHistory, qrsize) * PENALTY_N3;
 	return result;
 }
 
 
+// Transposes the given 32*32 block of modules in place, where module (x, y) is
+// bit x of block[y], by swapping ever smaller off-diagonal quadrants.
+static void transposeModuleBlock(uint32_t block[32]) {
+	uint32_t mask = UINT32_C(0x0000FFFF);
+	for (int j = 16; j != 0; j >>= 1, mask ^= mask << j) {
+		for (int k = 0; k < 32; k = (k + j + 1) & ~j) {
+			uint32_t t = ((block[k] >> j) ^ block[k + j]) & mask;
+			block[k] ^= t << j;
+			block[k + j] ^= t;
+		}
+	}
+}
+
+
 // Can only be called immediately after a light run is added, and
 // returns either 0, 1, or 2. A helper function for getPenaltyScore().
 static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize) {
@@ -779,6 +1550,20 @@ testable bool getModuleBounded(const uint8_t qrcode[], int x, int y) {
 }
 
 
+// Returns count (at most 32) modules of the given QR Code, starting from the given
+// index in the bitstream of modules, with the first one at bit 0 of the result.
+static uint32_t getModuleWord(const uint8_t qrcode[], int index, int count) {
+	assert(0 < count && count <= 32);
+	const uint8_t *bytes = &qrcode[(index >> 3) + 1];
+	int shift = index & 7;
+	uint64_t result = 0;
+	for (int i = 0; i * 8 < shift + count; i++)
+		result |= (uint64_t)bytes[i] << (i * 8);
+	result >>= shift;
+	return (uint32_t)result & (UINT32_MAX >> (32 - count));
+}
+
+
 // Sets the color of the module at the given coordinates, which must be in bounds.
 testable void setModuleBounded(uint8_t qrcode[], int x, int y, bool isDark) {
 	int qrsize = qrcode[0];
@@ -807,28 +1592,87 @@ static bool getBit(int x, int i) {
 }
 
 
+// Returns the index of the lowest set bit of the given nonzero value.
+static int countTrailingZeros(uint32_t x) {
+	assert(x != 0);
+#if defined(__GNUC__)
+	return __builtin_ctz(x);
+#else
+	int result = 0;
+	for (; (x & 1) == 0; x >>= 1)
+		result++;
+	return result;
+#endif
+}
+
+
+// Returns the number of set bits in the given value.
+static int countOnes(uint32_t x) {
+#if defined(__GNUC__)
+	return __builtin_popcount(x);
+#else
+	x -= (x >> 1) & UINT32_C(0x55555555);
+	x = (x & UINT32_C(0x33333333)) + ((x >> 2) & UINT32_C(0x33333333));
+	x = (x + (x >> 4)) & UINT32_C(0x0F0F0F0F);
+	return (int)((x * UINT32_C(0x01010101)) >> 24);
+#endif
+}
+
+
 
 /*---- Segment handling ----*/
 
 // Public function - see documentation comment in header file.
 bool qrcodegen_isNumeric(const char *text) {
 	assert(text != NULL);
-	for (; *text != '\0'; text++) {
-		if (*text < '0' || *text > '9')
-			return false;
-	}
-	return true;
+	size_t len = strlen(text);
+	size_t numericLen;
+	qrcodegen_classifyText(text, len, &numericLen, NULL);
+	return numericLen == len;
 }
 
 
 // Public function - see documentation comment in header file.
 bool qrcodegen_isAlphanumeric(const char *text) {
 	assert(text != NULL);
-	for (; *text != '\0'; text++) {
-		if (strchr(ALPHANUMERIC_CHARSET, *text) == NULL)
-			return false;
+	size_t len = strlen(text);
+	size_t alphanumericLen;
+	qrcodegen_classifyText(text, len, NULL, &alphanumericLen);
+	return alphanumericLen == len;
+}
+
+
+// Public function - see documentation comment in header file.
+enum qrcodegen_Mode qrcodegen_classifyText(const char text[], size_t len,
+		size_t *numericLen, size_t *alphanumericLen) {
+	assert(text != NULL || len == 0);
+	size_t i = 0;
+	for (; len - i >= 4; i += 4) {  // Skip digits four at a time
+		uint32_t word;
+		memcpy(&word, &text[i], sizeof(word));
+		if (!isDigitWord(word))
+			break;
 	}
-	return true;
+	while (i < len && ALPHANUMERIC_VALUES[(uint8_t)text[i]] < 10)
+		i++;
+	size_t numLen = i;
+	while (i < len && ALPHANUMERIC_VALUES[(uint8_t)text[i]] != NOT_ALPHANUMERIC)
+		i++;
+	if (numericLen != NULL)
+		*numericLen = numLen;
+	if (alphanumericLen != NULL)
+		*alphanumericLen = i;
+	if (numLen == len)
+		return qrcodegen_Mode_NUMERIC;
+	return i == len ? qrcodegen_Mode_ALPHANUMERIC : qrcodegen_Mode_BYTE;
+}
+
+
+// Tests whether all four bytes of the given word are ASCII digits, in any byte order.
+static bool isDigitWord(uint32_t word) {
+	uint32_t atLeastZero = (word | UINT32_C(0x80808080)) - UINT32_C(0x30303030);  // High bit set where low 7 bits >= '0'
+	uint32_t aboveNine = (word & UINT32_C(0x7F7F7F7F)) + UINT32_C(0x46464646);  // High bit set where low 7 bits > '9'
+	return ((~atLeastZero | aboveNine | word) & UINT32_C(0x80808080)) == 0;
 }
 
 
@@ -894,68 +1738,75 @@ struct qrcodegen_Segment qrcodegen_makeBytes(const uint8_t data[], size_t len, u
 // Public function - see documentation comment in header file.
 struct qrcodegen_Segment qrcodegen_makeNumeric(const char *digits, uint8_t buf[]) {
 	assert(digits != NULL);
-	struct qrcodegen_Segment result;
-	size_t len = strlen(digits);
-	result.mode = qrcodegen_Mode_NUMERIC;
-	int bitLen = calcSegmentBitLength(result.mode, len);
-	assert(bitLen != LENGTH_OVERFLOW);
-	result.numChars = (int)len;
-	if (bitLen > 0)
-		memset(buf, 0, ((size_t)bitLen + 7) / 8 * sizeof(buf[0]));
-	result.bitLength = 0;
-	
-	unsigned int accumData = 0;
-	int accumCount = 0;
-	for (; *digits != '\0'; digits++) {
-		char c = *digits;
-		assert('0' <= c && c <= '9');
-		accumData = accumData * 10 + (unsigned int)(c - '0');
-		accumCount++;
-		if (accumCount == 3) {
-			appendBitsToBuffer(accumData, 10, buf, &result.bitLength);
-			accumData = 0;
-			accumCount = 0;
-		}
-	}
-	if (accumCount > 0)  // 1 or 2 digits remaining
-		appendBitsToBuffer(accumData, accumCount * 3 + 1, buf, &result.bitLength);
-	assert(result.bitLength == bitLen);
-	result.data = buf;
-	return result;
+	return makeSegment(qrcodegen_Mode_NUMERIC, digits, strlen(digits), buf);
 }
 
 
 // Public function - see documentation comment in header file.
 struct qrcodegen_Segment qrcodegen_makeAlphanumeric(const char *text, uint8_t buf[]) {
 	assert(text != NULL);
+	return makeSegment(qrcodegen_Mode_ALPHANUMERIC, text, strlen(text), buf);
+}
+
+
+// Returns a segment representing the given len characters encoded in the given mode,
+// which is numeric, alphanumeric or byte. All the characters must be legal in that mode.
+static struct qrcodegen_Segment makeSegment(enum qrcodegen_Mode mode, const char text[], size_t len, uint8_t buf[]) {
 	struct qrcodegen_Segment result;
-	size_t len = strlen(text);
-	result.mode = qrcodegen_Mode_ALPHANUMERIC;
+	result.mode = mode;
 	int bitLen = calcSegmentBitLength(result.mode, len);
 	assert(bitLen != LENGTH_OVERFLOW);
 	result.numChars = (int)len;
-	if (bitLen > 0)
-		memset(buf, 0, ((size_t)bitLen + 7) / 8 * sizeof(buf[0]));
-	result.bitLength = 0;
-	
+	struct BitWriter bw;
+	bitWriterInit(&bw, buf, 0);
+	appendChars(&bw, mode, text, len);
+	bitWriterFinish(&bw);
+	result.bitLength = bw.bitLen;
+	assert(result.bitLength == bitLen);
+	result.data = buf;
+	return result;
+}
+
+
+// Appends the data bits of len characters of text in the given mode, which is numeric,
+// alphanumeric or byte. All the characters must be legal in that mode. This packs the
+// characters straight into any bit buffer, such as the data codewords of a QR Code.
+static void appendChars(struct BitWriter *bw, enum qrcodegen_Mode mode, const char text[], size_t len) {
+	assert(len <= (size_t)INT16_MAX);
 	unsigned int accumData = 0;
 	int accumCount = 0;
-	for (; *text != '\0'; text++) {
-		const char *temp = strchr(ALPHANUMERIC_CHARSET, *text);
-		assert(temp != NULL);
-		accumData = accumData * 45 + (unsigned int)(temp - ALPHANUMERIC_CHARSET);
-		accumCount++;
-		if (accumCount == 2) {
-			appendBitsToBuffer(accumData, 11, buf, &result.bitLength);
-			accumData = 0;
-			accumCount = 0;
+	if (mode == qrcodegen_Mode_NUMERIC) {
+		for (size_t i = 0; i < len; i++) {
+			char c = text[i];
+			assert('0' <= c && c <= '9');
+			accumData = accumData * 10 + (unsigned int)(c - '0');
+			accumCount++;
+			if (accumCount == 3) {
+				bitWriterAppend(bw, accumData, 10);
+				accumData = 0;
+				accumCount = 0;
+			}
 		}
+		if (accumCount > 0)  // 1 or 2 digits remaining
+			bitWriterAppend(bw, accumData, accumCount * 3 + 1);
+	} else if (mode == qrcodegen_Mode_ALPHANUMERIC) {
+		for (size_t i = 0; i < len; i++) {
+			unsigned int value = ALPHANUMERIC_VALUES[(uint8_t)text[i]];
+			assert(value != NOT_ALPHANUMERIC);
+			accumData = accumData * 45 + value;
+			accumCount++;
+			if (accumCount == 2) {
+				bitWriterAppend(bw, accumData, 11);
+				accumData = 0;
+				accumCount = 0;
+			}
+		}
+		if (accumCount > 0)  // 1 character remaining
+			bitWriterAppend(bw, accumData, 6);
+	} else {
+		assert(mode == qrcodegen_Mode_BYTE);
+		bitWriterAppendBits(bw, (const uint8_t *)text, (int)len * 8);
 	}
-	if (accumCount > 0)  // 1 character remaining
-		appendBitsToBuffer(accumData, 6, buf, &result.bitLength);
-	assert(result.bitLength == bitLen);
-	result.data = buf;
-	return result;
 }
 
 
@@ -986,6 +1837,82 @@ struct qrcodegen_Segment qrcodegen_makeEci(long assignVal, uint8_t buf[]) {
 }
 
 
+// Public function - see documentation comment in header file.
+size_t qrcodegen_makeSegmentsOptimally(const char text[], size_t textLen, int version,
+		uint8_t buf[], struct qrcodegen_Segment segs[], size_t maxSegs) {
+	assert(text != NULL || textLen == 0);
+	assert(segs != NULL || maxSegs == 0);
+	
+	// Costs are in sixths of a bit, so that every character has a whole cost. A segment's
+	// cost is rounded up to whole bits where it ends, which makes the total exact.
+	static const enum qrcodegen_Mode MODES[3] = {qrcodegen_Mode_BYTE, qrcodegen_Mode_ALPHANUMERIC, qrcodegen_Mode_NUMERIC};
+	static const int CHAR_COSTS[3] = {8 * 6, 11 * 3, 10 * 2};
+	long headCosts[3], costs[3];
+	for (int j = 0; j < 3; j++)
+		costs[j] = headCosts[j] = (4L + numCharCountBits(MODES[j], version)) * 6;
+	
+	// After character i, costs[j] is the least cost of text[0 : i+1] followed by the header of a
+	// segment in mode j, and bits 2j and 2j+1 of buf[i] hold the mode of character i in that case.
+	for (size_t i = 0; i < textLen; i++) {
+		int value = ALPHANUMERIC_VALUES[(uint8_t)text[i]];
+		long ended[3] = {costs[0] + CHAR_COSTS[0], LONG_MAX, LONG_MAX};
+		if (value != NOT_ALPHANUMERIC)
+			ended[1] = costs[1] + CHAR_COSTS[1];
+		if (value < 10)
+			ended[2] = costs[2] + CHAR_COSTS[2];
+		int from = 0;
+		for (int j = 0; j < 3; j++) {
+			int k = j;
+			costs[j] = ended[j];
+			for (int m = 0; m < 3; m++) {  // End the segment here and start one in mode j
+				long switched = ended[m] == LONG_MAX ? LONG_MAX : (ended[m] + 5) / 6 * 6 + headCosts[j];
+				if (switched < costs[j]) {
+					costs[j] = switched;
+					k = m;
+				}
+			}
+			from |= k << (2 * j);
+		}
+		buf[i] = (uint8_t)from;
+	}
+	
+	// Trace the cheapest encoding back from the end, leaving the mode of character i in buf[i]
+	int mode = 0;
+	for (int j = 1; j < 3; j++) {
+		if ((costs[j] + 5) / 6 < (costs[mode] + 5) / 6)
+			mode = j;
+	}
+	for (size_t i = textLen; i-- > 0; ) {
+		mode = (buf[i] >> (2 * mode)) & 3;
+		buf[i] = (uint8_t)mode;
+	}
+	size_t numSegs = 0;
+	for (size_t i = 0, start = 0; i < textLen; i++) {
+		if (i + 1 == textLen || buf[i + 1] != buf[i]) {  // Character i ends a segment
+			if (calcSegmentBitLength(MODES[buf[i]], i + 1 - start) == LENGTH_OVERFLOW)
+				return SIZE_MAX;
+			numSegs++;
+			start = i + 1;
+		}
+	}
+	if (numSegs > maxSegs)
+		return numSegs;
+	
+	// Pack each run of characters in one mode. A segment's data never takes more bytes than
+	// it has characters, so the packed data never overwrites modes that are still to be read.
+	uint8_t *data = buf;
+	for (size_t i = 0, n = 0; i < textLen; n++) {
+		size_t start = i;
+		mode = buf[i];
+		while (i < textLen && buf[i] == mode)
+			i++;
+		segs[n] = makeSegment(MODES[mode], &text[start], i - start, data);
+		data += (segs[n].bitLength + 7) / 8;
+	}
+	return numSegs;
+}
+
+
 // Calculates the number of bits needed to encode the given segments at the given version.
 // Returns a non-negative number if successful. Otherwise returns LENGTH_OVERFLOW if a segment
 // has too many characters to fit its length field, or the total bits exceeds INT16_MAX.
@@ -71,6 +71,10 @@ enum qrcodegen_Mask {
 	// A special value to tell the QR Code encoder to
 	// automatically select an appropriate mask pattern
 	qrcodegen_Mask_AUTO = -1,
+	// Like qrcodegen_Mask_AUTO, but chooses from an estimate that skips the column
+	// rules, for about half the work. The result is still a valid QR Code, and its
+	// penalty score is usually within a few percent of the best mask's.
+	qrcodegen_Mask_FAST = -2,
 	// The eight actual mask patterns
 	qrcodegen_Mask_0 = 0,
 	qrcodegen_Mask_1,
@@ -143,6 +147,46 @@ struct qrcodegen_Segment {
 // Use this more convenient value to avoid calculating tighter memory bounds for buffers.
 #define qrcodegen_BUFFER_LEN_MAX  qrcodegen_BUFFER_LEN_FOR_VERSION(qrcodegen_VERSION_MAX)
 
+// The number of bytes of scratch space that lets qrcodegen_encodeSegmentsScratch() build all
+// eight mask candidates of a QR Code of the given version at once.
+#define qrcodegen_MASK_SCRATCH_LEN_FOR_VERSION(n)  (8 * qrcodegen_BUFFER_LEN_FOR_VERSION(n))
+
+// Versions up to and including this number have their function modules and codeword placement cached
+// in RAM the first time they are used, so later encodes at those versions skip recomputing them. Define as 0 to disable the
+// cache, or limit it to the versions actually used; qrcodegen_CACHE_LEN gives the cost in bytes.
+#ifndef QRCODEGEN_CACHE_VERSION_MAX
+	#define QRCODEGEN_CACHE_VERSION_MAX  10
+#endif
+
+// The total number of bytes of RAM used by the per-version caches, as a compile-time constant.
+// With the default QRCODEGEN_CACHE_VERSION_MAX of 10, this value equals 7310. When built with
+// QRCODEGEN_GENERATED_TABLES, as the MicroPython module is, the placement maps are constants
+// from gen_tables.py instead of RAM, and the default value is 4170.
+#ifdef QRCODEGEN_GENERATED_TABLES
+	#define qrcodegen_CACHE_LEN  qrcodegen_SUM_CACHED_(qrcodegen_TEMPLATE_LEN_)
+#else
+	#define qrcodegen_CACHE_LEN  (qrcodegen_SUM_CACHED_(qrcodegen_TEMPLATE_LEN_) \
+		+ qrcodegen_SUM_CACHED_(qrcodegen_PLACEMENT_MAP_LEN_) * 2)
+#endif
+
+// The cache space for one version: two buffers, one for the function module map and one for the patterns drawn on it.
+#define qrcodegen_TEMPLATE_LEN_(n)  (2 * qrcodegen_BUFFER_LEN_FOR_VERSION(n))
+
+// The number of uint16 in the placement map of one version: a count, then up to 12 * n + 12 runs of two values each.
+#define qrcodegen_PLACEMENT_MAP_LEN_(n)  (1 + 2 * (12 * (n) + 12))
+
+// Sums f(n) over the versions n that are cached.
+#define qrcodegen_SUM_CACHED_(f)  ( \
+	qrcodegen_IF_CACHED_(f, 1) + qrcodegen_IF_CACHED_(f, 2) + qrcodegen_IF_CACHED_(f, 3) + qrcodegen_IF_CACHED_(f, 4) + qrcodegen_IF_CACHED_(f, 5) + \
+	qrcodegen_IF_CACHED_(f, 6) + qrcodegen_IF_CACHED_(f, 7) + qrcodegen_IF_CACHED_(f, 8) + qrcodegen_IF_CACHED_(f, 9) + qrcodegen_IF_CACHED_(f, 10) + \
+	qrcodegen_IF_CACHED_(f, 11) + qrcodegen_IF_CACHED_(f, 12) + qrcodegen_IF_CACHED_(f, 13) + qrcodegen_IF_CACHED_(f, 14) + qrcodegen_IF_CACHED_(f, 15) + \
+	qrcodegen_IF_CACHED_(f, 16) + qrcodegen_IF_CACHED_(f, 17) + qrcodegen_IF_CACHED_(f, 18) + qrcodegen_IF_CACHED_(f, 19) + qrcodegen_IF_CACHED_(f, 20) + \
+	qrcodegen_IF_CACHED_(f, 21) + qrcodegen_IF_CACHED_(f, 22) + qrcodegen_IF_CACHED_(f, 23) + qrcodegen_IF_CACHED_(f, 24) + qrcodegen_IF_CACHED_(f, 25) + \
+	qrcodegen_IF_CACHED_(f, 26) + qrcodegen_IF_CACHED_(f, 27) + qrcodegen_IF_CACHED_(f, 28) + qrcodegen_IF_CACHED_(f, 29) + qrcodegen_IF_CACHED_(f, 30) + \
+	qrcodegen_IF_CACHED_(f, 31) + qrcodegen_IF_CACHED_(f, 32) + qrcodegen_IF_CACHED_(f, 33) + qrcodegen_IF_CACHED_(f, 34) + qrcodegen_IF_CACHED_(f, 35) + \
+	qrcodegen_IF_CACHED_(f, 36) + qrcodegen_IF_CACHED_(f, 37) + qrcodegen_IF_CACHED_(f, 38) + qrcodegen_IF_CACHED_(f, 39) + qrcodegen_IF_CACHED_(f, 40))
+#define qrcodegen_IF_CACHED_(f, n)  ((n) <= QRCODEGEN_CACHE_VERSION_MAX ? f(n) : 0)
+
 
 
 /*---- Functions (high level) to generate QR Codes ----*/
@@ -159,7 +203,8 @@ struct qrcodegen_Segment {
  * chosen for the output. Iff boostEcl is true, then the ECC level of the result
  * may be higher than the ecl argument if it can be done without increasing the
  * version. The mask is either between qrcodegen_Mask_0 to 7 to force that mask, or
- * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow).
+ * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow),
+ * or qrcodegen_Mask_FAST to choose one more quickly from an estimate.
  * 
  * About the arrays, letting len = qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion):
  * - Before calling the function:
@@ -188,6 +233,18 @@ bool qrcodegen_encodeText(const char *text, uint8_t tempBuffer[], uint8_t qrcode
 	enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl);
 
 
+/* 
+ * Encodes the given text[0 : textLen] as a single segment in the given mode (numeric,
+ * alphanumeric or byte), packing the characters straight into the data codewords without
+ * an intermediate segment buffer. The text need not be NUL-terminated, and every character
+ * must be legal in the mode; qrcodegen_classifyText() finds the most compact mode and the
+ * offset of any character that doesn't suit a mode. Otherwise this is the same as
+ * qrcodegen_encodeText(), including the requirements on tempBuffer and qrcode.
+ */
+bool qrcodegen_encodeChars(const char text[], size_t textLen, enum qrcodegen_Mode mode, uint8_t tempBuffer[],
+	uint8_t qrcode[], enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl);
+
+
 /* 
  * Encodes the given binary data to a QR Code, returning true if successful.
  * If the data is too long to fit in any version in the given range
@@ -199,7 +256,8 @@ bool qrcodegen_encodeText(const char *text, uint8_t tempBuffer[], uint8_t qrcode
  * chosen for the output. Iff boostEcl is true, then the ECC level of the result
  * may be higher than the ecl argument if it can be done without increasing the
  * version. The mask is either between qrcodegen_Mask_0 to 7 to force that mask, or
- * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow).
+ * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow),
+ * or qrcodegen_Mask_FAST to choose one more quickly from an estimate.
  * 
  * About the arrays, letting len = qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion):
  * - Before calling the function:
@@ -275,7 +333,8 @@ bool qrcodegen_encodeSegments(const struct qrcodegen_Segment segs[], size_t len,
  * chosen for the output. Iff boostEcl is true, then the ECC level of the result
  * may be higher than the ecl argument if it can be done without increasing the
  * version. The mask is either between qrcodegen_Mask_0 to 7 to force that mask, or
- * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow).
+ * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow),
+ * or qrcodegen_Mask_FAST to choose one more quickly from an estimate.
  * 
  * About the byte arrays, letting len = qrcodegen_BUFFER_LEN_FOR_VERSION(qrcodegen_VERSION_MAX):
  * - Before calling the function:
@@ -303,6 +362,45 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[]);
 
 
+/* 
+ * Same as qrcodegen_encodeSegmentsAdvanced(), but with a scratch buffer that automatic mask
+ * selection (qrcodegen_Mask_AUTO or qrcodegen_Mask_FAST) can use to trade RAM for time.
+ * Instead of masking the QR Code and undoing it for each mask in turn, it builds several masked
+ * candidates at once, as many as fit in scratchLen bytes, and scores them separately. The space for
+ * all eight at the version chosen is qrcodegen_MASK_SCRATCH_LEN_FOR_VERSION(version); if there
+ * isn't room for at least two, or scratchLen is 0, this works just like the function without it.
+ * The result is the same either way. The scratch buffer must not overlap the other buffers, and
+ * holds no useful data afterward.
+ */
+bool qrcodegen_encodeSegmentsScratch(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[],
+	uint8_t scratch[], size_t scratchLen);
+
+
+/* 
+ * Same as qrcodegen_encodeSegmentsScratch(), except that if text isn't NULL, each segment's
+ * data is ignored and instead packed from the next numChars characters of text, straight into
+ * the data codewords. Such segments must be numeric, alphanumeric or byte mode, and their
+ * characters must be legal in that mode. This suits the segments that
+ * qrcodegen_makeSegmentsOptimally() returns, once the buffer they were packed in is gone.
+ */
+bool qrcodegen_encodeSegmentsText(const struct qrcodegen_Segment segs[], size_t len, const char text[],
+	enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl,
+	uint8_t tempBuffer[], uint8_t qrcode[], uint8_t scratch[], size_t scratchLen);
+
+
+/* 
+ * Returns the smallest version number in the range [minVersion, maxVersion] whose data capacity
+ * at the given ECC level can hold the given segments, or 0 if none of them can. Only the mode,
+ * numChars and bitLength fields of the segments are read. This is the version that the encoding
+ * functions choose, so the caller can size tempBuffer and qrcode for it alone, using
+ * qrcodegen_BUFFER_LEN_FOR_VERSION(version), and pass it as both minVersion and maxVersion.
+ * Requires 1 <= minVersion <= maxVersion <= 40.
+ */
+int qrcodegen_getMinVersion(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+	int minVersion, int maxVersion);
+
+
 /* 
  * Tests whether the given string can be encoded as a segment in numeric mode.
  * A string is encodable iff each character is in the range 0 to 9.
@@ -318,6 +416,16 @@ bool qrcodegen_isNumeric(const char *text);
 bool qrcodegen_isAlphanumeric(const char *text);
 
 
+/* 
+ * Scans text[0 : len] once and returns the most compact mode that can encode all of it:
+ * numeric, alphanumeric or byte. The text need not be NUL-terminated. If numericLen or
+ * alphanumericLen isn't NULL, it receives the length of the longest prefix that is legal
+ * in that mode, which is the offset of the first illegal character, or len if there is none.
+ */
+enum qrcodegen_Mode qrcodegen_classifyText(const char text[], size_t len,
+	size_t *numericLen, size_t *alphanumericLen);
+
+
 /* 
  * Returns the number of bytes (uint8_t) needed for the data buffer of a segment
  * containing the given number of characters using the given mode. Notes:
@@ -361,6 +469,20 @@ struct qrcodegen_Segment qrcodegen_makeAlphanumeric(const char *text, uint8_t bu
 struct qrcodegen_Segment qrcodegen_makeEci(long assignVal, uint8_t buf[]);
 
 
+/* 
+ * Splits the given text into numeric, alphanumeric and byte mode segments so that their
+ * total bit length at the given version is as small as possible, and returns the number of
+ * segments. Only the width of the character count fields depends on the version, so the
+ * result is the same for all versions in each of the ranges 1-9, 10-26 and 27-40.
+ * The text is textLen bytes (e.g. UTF-8), not necessarily NUL-terminated. buf must hold at
+ * least textLen bytes, not overlapping the text, and receives the data of the segments.
+ * If the result is more than maxSegs, then nothing is stored in segs and buf holds no useful data.
+ * The result is SIZE_MAX if a segment would be too long for any QR Code (over 32767 bits).
+ */
+size_t qrcodegen_makeSegmentsOptimally(const char text[], size_t textLen, int version,
+	uint8_t buf[], struct qrcodegen_Segment segs[], size_t maxSegs);
+
+
 /*---- Functions to extract raw data from QR Codes ----*/
 
 /* 
@@ -23,10 +23,28 @@ with open('data/result.py', 'wt') as fd:
         assert q3.width() != q2.width()      # force bytes works
         assert q3.width() == q.width()      # force bytes works
 
+    if 1:
+        # any buffer works for every encoding, and matches the same text as a str
+        buf = bytearray(b'xx12345678901234567890yy')
+        for enc in (0, uqr.Mode_NUMERIC, uqr.Mode_OPTIMAL):
+            q = uqr.make(memoryview(buf)[2:-2], encoding=enc)
+            assert q.packed() == uqr.make('12345678901234567890', encoding=enc).packed()
+        q = uqr.make(b'HELLO WORLD', encoding=uqr.Mode_ALPHANUMERIC)
+        assert q.packed() == uqr.make('HELLO WORLD').packed()
+
     if 1:
         make_qr(fd, 'numeric', '123'*50, encoding=uqr.Mode_NUMERIC)
         make_qr(fd, 'numeric', '12345678', encoding=uqr.Mode_NUMERIC)
 
+    if 1:
+        # characters that don't suit the forced encoding are reported by offset
+        for enc, msg in [(uqr.Mode_NUMERIC, '1234a'), (uqr.Mode_ALPHANUMERIC, 'ABCDx')]:
+            try:
+                uqr.make(msg, encoding=enc)
+                assert False, msg
+            except ValueError as exc:
+                assert 'offset 4' in str(exc), exc
+
     if 1:
         num = 0
         for ecl in range(0, 3):
@@ -37,9 +55,192 @@ with open('data/result.py', 'wt') as fd:
                                 encoding=uqr.Mode_NUMERIC, mask=m, max_version=1)
                 num += 1
 
+    if 1:
+        # mixed segments are never bigger than the best single encoding
+        uri = 'bitcoin:BC1QAR0SRRR7XFKVY5L643LYDNW9RE59GTZZWF5MDQ?amount=0.00123456&label=Test'
+        q = make_qr(fd, 'optimal_uri', uri, encoding=uqr.Mode_OPTIMAL)
+        assert q.version() < uqr.make(uri).version()
+        make_qr(fd, 'optimal_alnum', 'ABC'*50, encoding=uqr.Mode_OPTIMAL)
+        make_qr(fd, 'optimal_big', ('12345678901234567890abc'*60), encoding=uqr.Mode_OPTIMAL,
+                        max_version=40)
+
     if 1:
         make_qr(fd, 'biggest', 'a'*2953, max_version=40)
 
+    if 1:
+        # quick mask choice still makes readable codes
+        make_qr(fd, 'fast_mask_small', 'fast'*10, mask=uqr.Mask_FAST)
+        make_qr(fd, 'fast_mask_big', 'fast'*400, mask=uqr.Mask_FAST, max_version=40)
+
+    if 1:
+        # reusing an encoder and its result gives the same codes as make()
+        enc = uqr.Encoder(max_version=40)
+        q = enc.encode('abc123')
+        for msg in ['ABC'*50, 'a'*2953, '12345', b'bytes\x00']:
+            assert enc.encode(msg, out=q) is q
+            assert q.packed() == uqr.make(msg).packed(), msg
+        # running out of memory for a bigger QR leaves the old one in place
+        import micropython
+        if hasattr(micropython, 'heap_lock'):
+            want, msg, raised = q.packed(), 'y'*900, False
+            micropython.heap_lock()
+            try:
+                enc.encode(msg, out=q)
+            except MemoryError:
+                raised = True
+            micropython.heap_unlock()
+            assert raised and q.packed() == want and q.width() == want[1]
+    if 1:
+        # batches match one at a time
+        msgs = ['abc123', 'ABC'*50, '12345'*20, b'bytes\x00']
+        qrs = uqr.make_many(msgs, max_version=40)
+        assert [q.packed() for q in qrs] == [uqr.make(m).packed() for m in msgs]
+        buf = bytearray(4000)
+        offs = uqr.make_many(msgs, max_version=40, into=buf)
+        assert len(offs) == len(msgs) + 1
+        for i, q in enumerate(qrs):
+            assert buf[offs[i]] == q.width()
+            assert buf[offs[i]+1:offs[i+1]] == q.packed()[2]
+    if 1:
+        # packed_into() writes what packed() returns, in place
+        q = uqr.make('packed into')
+        w, h, pix = q.packed()
+        buf = bytearray(len(pix))
+        assert q.packed_into(buf) == (w, h)
+        assert buf == pix
+        wide = bytearray(w//8 * h * 2)
+        q.packed_into(wide, stride=w//4, invert=True)
+        assert wide[w//8:w//4] == bytes(w//8)
+        assert bytes(b ^ 0xff for b in wide[:w//8]) == pix[:w//8]
+        for stride in (w//8 - 1, len(wide) + 1, 24403224):
+            try:
+                q.packed_into(wide, stride=stride)
+                assert False, stride
+            except ValueError:
+                pass
+    if 1:
+        # render_into() matches get(), at odd offsets and through a viewport
+        q = uqr.make('render into')
+        w = q.width()
+        fb = bytearray(12 * 80)
+        q.render_into(fb, 3, 1, 3, border=2, stride=12, viewport=(5, 4, 60, 70))
+        for py in range(80):
+            for px in range(96):
+                bit = (fb[py*12 + px//8] >> (7 - px % 8)) & 1
+                if 3 <= px < 63 and 1 <= py < 71:
+                    mx, my = (px - 3 + 5)//3 - 2, (py - 1 + 4)//3 - 2
+                    assert bit == (0 <= mx < w and 0 <= my < w and q.get(mx, my)), (px, py)
+                else:
+                    assert bit == 0, (px, py)
+        # offsets and strides too big for the buffer are refused, not wrapped
+        for kw in (dict(x=0x7ffffff0), dict(y=0x7ffffff0), dict(stride=0x40000001)):
+            try:
+                q.render_into(fb, **kw)
+                assert False, kw
+            except ValueError:
+                pass
+    try:
+        import framebuf
+    except ImportError:
+        framebuf = None
+
+    if framebuf:
+        # each pixel format draws what framebuf reads back
+        q = uqr.make('formats')
+        side = (q.width() + 2) * 2
+        for fmt, bpp, align in [(uqr.MONO_VLSB, 1, 1), (uqr.MONO_HMSB, 1, 8), (uqr.GS2_HMSB, 2, 4),
+                                    (uqr.GS4_HMSB, 4, 2), (uqr.RGB565, 16, 1)]:
+            width = (side + align - 1) // align * align     # framebuf's own stride
+            if fmt == uqr.MONO_VLSB:
+                buf, stride = bytearray(width * ((side + 7) // 8)), width
+            else:
+                buf, stride = bytearray(width * side * bpp // 8), width * bpp // 8
+            fb = framebuf.FrameBuffer(buf, side, side, fmt)
+            q.render_into(buf, 0, 0, 2, border=1, fmt=fmt, colors=(1, 0), stride=stride)
+            for py in range(side):
+                for px in range(side):
+                    assert fb.pixel(px, py) == q.get(px//2 - 1, py//2 - 1), (fmt, px, py)
+        assert (uqr.MONO_VLSB, uqr.MONO_HLSB, uqr.RGB565) == \
+                    (framebuf.MONO_VLSB, framebuf.MONO_HLSB, framebuf.RGB565)
+    if 1:
+        # rows() hands out what render_into() draws, a row at a time
+        q = uqr.make('rows')
+        side = (q.width() + 4) * 3
+        img = bytearray((side + 7)//8 * side)
+        q.render_into(img, scale=3, border=2)
+        got = bytearray()
+        last = None
+        for row in q.rows(scale=3, border=2):
+            assert last is None or row is last
+            got.extend(row)
+            last = row
+        assert got == img
+        # MONO_VLSB pages of 8 rows into a caller's buffer; the last page is part
+        # filled (side is odd), and its unused rows must come back clear
+        side = q.width() + 4
+        img = bytearray(side * ((side + 7)//8))
+        q.render_into(img, border=2, fmt=uqr.MONO_VLSB)
+        buf = bytearray(b'\xff' * (side + 3))
+        got = bytearray()
+        for row in q.rows(border=2, fmt=uqr.MONO_VLSB, buf=buf):
+            assert row is buf
+            got.extend(row[:side])
+        assert got == img
+        # a buf too small for a row is refused when the row is drawn
+        try:
+            next(q.rows(scale=3, buf=bytearray(q.width() * 3 // 8)))
+            assert False
+        except ValueError:
+            pass
+        # re-encoding the QR part way through is caught, even at the same size
+        rows = q.rows()
+        next(rows)
+        w = q.width()
+        uqr.Encoder().encode('ROWZ', out=q)
+        assert q.width() == w
+        try:
+            next(rows)
+            assert False
+        except ValueError:
+            pass
+    if 1:
+        # buffer protocol gives packed() without a copy
+        q = uqr.make('buffer protocol')
+        size, stride, fmt = q.layout()
+        assert (size, stride, fmt) == (q.width(), (q.width() + 7)//8, uqr.MONO_HLSB)
+        assert bytes(memoryview(q)) == q.packed()[2]
+        # read-only, so a view can't change what get() and packed() report
+        try:
+            memoryview(q)[0] = 0xff
+            assert False
+        except TypeError:
+            pass
+        assert bytes(memoryview(q)) == q.packed()[2]
+        # a view keeps the rows alive once the QR itself is gone
+        import gc
+        want = q.packed()[2]
+        view = memoryview(q)
+        del q
+        gc.collect()
+        junk = [bytearray(len(want)) for i in range(20)]
+        assert bytes(view) == want
+        # encode(out=) doesn't draw over a QR that is still being viewed or read
+        enc = uqr.Encoder()
+        q = uqr.make('viewed')
+        view = memoryview(q)
+        want = bytes(view)
+        enc.encode('other', out=q)
+        assert bytes(view) == want and q.packed()[2] != want
+        want = uqr.make(q).packed()
+        assert enc.encode(q, out=q).packed() == want
+    if 1:
+        # console output, half height and full; test_uqr.py checks what lands on stdout
+        q = uqr.make('show')
+        print('_show = %r' % dict(packed=q.packed(), text=str(q)), file=fd)
+        for border, invert, ascii in [(4, 0, 0), (1, 1, 0), (0, 0, 0), (0, 0, 1)]:
+            print('--- show border=%d invert=%d ascii=%d' % (border, invert, ascii))
+            q.show(border=border, invert=invert, ascii=ascii)
+        print('--- end')
 
 # test for leaks, weak.
 import gc
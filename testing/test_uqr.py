@@ -58,4 +58,49 @@ def test_readability(name, values, read_qr):
 
     assert actual == expected
 
+def show_output():
+    # what mpy_test_code.py printed after each '--- show ...' marker
+    sections, key = {}, None
+    with open('data/stdout.txt', encoding='utf-8') as fd:
+        for ln in fd.read().split('\n'):
+            if ln.startswith('--- '):
+                key = ln[4:]
+                sections[key] = []
+            elif key:
+                sections[key].append(ln)
+    return sections
+
+def test_show():
+    w, h, pixels = rx._show['packed']
+    out = show_output()
+
+    def ink(x, y, invert):
+        dark = 0 <= x < h and 0 <= y < h and bool(pixels[y*(w//8) + x//8] & (0x80 >> (x % 8)))
+        return dark != invert
+
+    glyphs = { (0, 0): ' ', (0, 1): '\u2584', (1, 0): '\u2580', (1, 1): '\u2588' }
+
+    for border, invert in [(4, 0), (1, 1), (0, 0)]:
+        lines = out['show border=%d invert=%d ascii=0' % (border, invert)]
+        span = range(-border, h + border)
+        assert len(lines) == (h + 2*border + 1) // 2
+        for y, line in zip(span[::2], lines):
+            # no ink below the last row, inverted or not
+            assert line == ''.join(glyphs[ink(x, y, invert), y + 1 < h + border and ink(x, y + 1, invert)]
+                                        for x in span), (border, invert, y)
+
+    # top two rows of the finders, and the odd last row alone in the top half
+    first, *_, last = out['show border=0 invert=0 ascii=0']
+    assert first.startswith('\u2588' + '\u2580'*5 + '\u2588 ')
+    assert first.endswith(' \u2588' + '\u2580'*5 + '\u2588')
+    assert last.startswith('\u2580'*7 + ' ')
+    assert set(last) <= {' ', '\u2580'}
+
+    # inverted, the light quiet zone is the ink
+    assert out['show border=1 invert=1 ascii=0'][-1] == '\u2580' * (h + 2)
+    assert set(out['show border=4 invert=0 ascii=0'][-1]) == {' '}
+
+    # ascii matches print()
+    assert ''.join(ln + '\n' for ln in out['show border=0 invert=0 ascii=1']) == rx._show['text']
+
 # EOF